@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "components.hpp"
+#include "ecs.hpp"
+
+// Microbenchmarks of the core ECS operations, written out as JSON
+//
+// bench [--sizes 1000,10000] [--reps n]
+//
+// Every repetition starts from a new world and only the operation itself
+// is timed. One untimed repetition runs first to warm up. Times are per
+// entity, so sizes can be compared with each other.
+
+#ifdef ECS_ARCHETYPES
+static const char *backend = "archetype";
+#else
+static const char *backend = "sparse_set";
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+// Results are added in here so the compiler can't drop the work
+static volatile uint64_t sink = 0;
+
+class MoveSystem : public System
+{
+    public:
+        MoveSystem()
+        {
+            required.set(Transform::id);
+            required.set(Velocity::id);
+            access.write<Transform>();
+            access.read<Velocity>();
+        }
+        void update(const float dt)
+        {
+            manager->view<Transform, const Velocity>().each([dt](Entity, auto &&t, auto &&v)
+            {
+                t.x += v.x * dt;
+                t.y += v.y * dt;
+            });
+        }
+};
+
+class HealSystem : public System
+{
+    public:
+        HealSystem()
+        {
+            required.set(Health::id);
+            access.write<Health>();
+        }
+        void update(const float dt)
+        {
+            manager->view<Health>().each([dt](Entity, auto &&h)
+            {
+                h.immunity -= dt;
+            });
+        }
+};
+
+// Matches every entity with a Health, for update_entity() to find
+class MatchSystem : public System
+{
+    public:
+        MatchSystem()
+        {
+            required.set(Transform::id);
+            required.set(Health::id);
+            access.read<Transform, Health>();
+        }
+        void update(const float)
+        {
+        }
+};
+
+struct World
+{
+    World() : m(), entities({})
+    {
+        m.create_component<Transform>();
+        m.create_component<Velocity>();
+        m.create_component<Health>();
+        m.create_system<MoveSystem>(new MoveSystem());
+        m.create_system<HealSystem>(new HealSystem());
+        m.create_system<MatchSystem>(new MatchSystem());
+    }
+    // n moving entities, every other one with Health as well
+    void populate(const std::size_t n)
+    {
+        m.create_batch<Transform, Velocity>(n, [](std::size_t i, Transform &t, Velocity &v)
+        {
+            t = Transform(i % 512, i / 512 % 512, 0.0);
+            v = Velocity(1.0, i * 0.1);
+        });
+        m.view<const Transform>().each([this](Entity e, auto&&)
+        {
+            entities.push_back(e);
+        });
+        for(std::size_t i = 0; i < entities.size(); i += 2)
+        {
+            m.add_entity_component<Health>(entities[i], Health(5));
+        }
+    }
+    Manager m;
+    std::vector<Entity> entities;
+};
+
+struct Result
+{
+    std::string name;
+    std::size_t entities;
+    std::size_t reps;
+    double median_ns;
+    double p99_ns;
+};
+
+template<typename F>
+double time_ns(F f)
+{
+    const auto start = Clock::now();
+    f();
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+// f(world) sets the world up and returns how long the timed part took
+template<typename F>
+Result measure(const char *name, const std::size_t n, const std::size_t reps, F f)
+{
+    std::cerr << name << " " << n << std::endl;
+
+    std::vector<double> samples;
+    for(std::size_t r = 0; r <= reps; ++r)
+    {
+        World w;
+        const double ns = f(w);
+        if(r > 0)
+        {
+            samples.push_back(ns / n);
+        }
+    }
+
+    // Nearest rank, with few repetitions p99 is the slowest
+    std::sort(samples.begin(), samples.end());
+    const std::size_t mid = samples.size() / 2;
+    const double median = samples.size() % 2 == 1 ? samples[mid] : (samples[mid - 1] + samples[mid]) / 2;
+    const std::size_t rank = (samples.size() * 99 + 99) / 100;
+    return Result{name, n, reps, median, samples[rank - 1]};
+}
+
+std::vector<Result> run(const std::size_t n, const std::size_t reps)
+{
+    std::vector<Result> results;
+
+    results.push_back(measure("get_entity", n, reps, [n](World &w)
+    {
+        w.entities.reserve(n);
+        return time_ns([&]()
+        {
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                w.entities.push_back(w.m.em.get_entity());
+            }
+        });
+    }));
+
+    // Matched against the systems as it goes, like the game does
+    results.push_back(measure("add_entity_component", n, reps, [n](World &w)
+    {
+        for(std::size_t i = 0; i < n; ++i)
+        {
+            w.entities.push_back(w.m.em.get_entity());
+        }
+        return time_ns([&]()
+        {
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                w.m.add_entity_component<Transform>(w.entities[i], Transform(i % 512, 0.0, 0.0));
+            }
+        });
+    }));
+
+    results.push_back(measure("get_entity_component", n, reps, [n](World &w)
+    {
+        w.populate(n);
+        return time_ns([&]()
+        {
+            float total = 0.0f;
+            for(auto e : w.entities)
+            {
+                total += (*w.m.get_entity_component<Velocity>(e)).x;
+            }
+            sink += static_cast<uint64_t>(total);
+        });
+    }));
+
+    // Half of the entities have one
+    results.push_back(measure("entity_has_component", n, reps, [n](World &w)
+    {
+        w.populate(n);
+        return time_ns([&]()
+        {
+            uint64_t count = 0;
+            for(auto e : w.entities)
+            {
+                count += w.m.cm.entity_has_component(e, Health::id);
+            }
+            sink += count;
+        });
+    }));
+
+    // One Manager::update() of the three systems
+    results.push_back(measure("system_iteration", n, reps, [n](World &w)
+    {
+        w.populate(n);
+        return time_ns([&]()
+        {
+            w.m.update(1.0/60);
+        });
+    }));
+
+    // Every entity destroyed through the command buffer in one update
+    results.push_back(measure("bulk_destroy", n, reps, [n](World &w)
+    {
+        w.populate(n);
+        for(auto e : w.entities)
+        {
+            w.m.commands.destroy(e);
+        }
+        return time_ns([&]()
+        {
+            w.m.update(1.0/60);
+        });
+    }));
+
+    // Components are added behind the system manager's back so every
+    // entity is new to it
+    results.push_back(measure("update_entity", n, reps, [n](World &w)
+    {
+        for(std::size_t i = 0; i < n; ++i)
+        {
+            const Entity e = w.m.em.get_entity();
+            w.m.cm.add_entity_component<Transform>(e, Transform());
+            w.m.cm.add_entity_component<Velocity>(e, Velocity());
+            if(i % 2 == 0)
+            {
+                w.m.cm.add_entity_component<Health>(e, Health(5));
+            }
+            w.entities.push_back(e);
+        }
+        return time_ns([&]()
+        {
+            for(auto e : w.entities)
+            {
+                w.m.sm.update_entity(e, w.m.cm.signature(e));
+            }
+        });
+    }));
+
+    return results;
+}
+
+void print_json(std::ostream &out, const std::vector<Result> &results)
+{
+    out << "{" << std::endl;
+    out << "  \"backend\": \"" << backend << "\"," << std::endl;
+    out << "  \"unit\": \"ns per entity\"," << std::endl;
+    out << "  \"results\": [" << std::endl;
+    for(std::size_t i = 0; i < results.size(); ++i)
+    {
+        const Result &r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"entities\": " << r.entities << ", \"reps\": " << r.reps
+            << ", \"median\": " << r.median_ns << ", \"p99\": " << r.p99_ns << "}"
+            << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    out << "  ]" << std::endl;
+    out << "}" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::size_t> sizes = {1000, 10000, 100000, 1000000};
+    std::size_t reps = 0;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "--sizes") == 0 && i + 1 < argc)
+        {
+            sizes.clear();
+            std::stringstream list(argv[++i]);
+            std::string size;
+            while(std::getline(list, size, ','))
+            {
+                sizes.push_back(std::strtoul(size.c_str(), nullptr, 10));
+            }
+        }
+        else if(strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+        {
+            reps = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+    for(auto n : sizes)
+    {
+        if(n == 0 || n > EntityManager::default_capacity)
+        {
+            std::cerr << "Sizes must be between 1 and " << EntityManager::default_capacity << std::endl;
+            return 1;
+        }
+        // Fewer repetitions of the big sizes so the whole run takes minutes
+        const std::size_t r = reps > 0 ? reps : std::max<std::size_t>(5, std::min<std::size_t>(50, 2000000 / n));
+        const std::vector<Result> sized = run(n, r);
+        results.insert(results.end(), sized.begin(), sized.end());
+    }
+
+    print_json(std::cout, results);
+    return 0;
+}
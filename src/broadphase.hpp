@@ -0,0 +1,681 @@
+#ifndef BROADPHASE_HPP
+#define BROADPHASE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <vector>
+#include "entity.hpp"
+
+// Two colliders whose boxes overlap, as indices into the collider array
+// The one with the lower entity comes first
+struct ColliderPair
+{
+    uint32_t a;
+    uint32_t b;
+};
+
+inline bool operator<(const ColliderPair &x, const ColliderPair &y)
+{
+    return x.a < y.a || (x.a == y.a && x.b < y.b);
+}
+
+inline bool operator==(const ColliderPair &x, const ColliderPair &y)
+{
+    return x.a == y.a && x.b == y.b;
+}
+
+// Which collision layers can hit which, up to 32 layers
+// Layers that can't hit each other either way are never paired up, so the
+// broadphases check this before doing any other work on a pair.
+class CollisionMatrix
+{
+    public:
+        static const int max_layers = 32;
+
+        CollisionMatrix() : hit_by({})
+        {
+        }
+        // Everything hits everything
+        static CollisionMatrix all()
+        {
+            CollisionMatrix m;
+            m.hit_by.fill(0xFFFFFFFF);
+            return m;
+        }
+        // Entities on layer target can be hit by ones on layer source
+        void allow(const uint8_t target, const uint8_t source)
+        {
+            assert(target < max_layers && source < max_layers);
+            hit_by[target] |= 1u << source;
+        }
+        // Both ways
+        void collide(const uint8_t a, const uint8_t b)
+        {
+            allow(a, b);
+            allow(b, a);
+        }
+        bool allows(const uint8_t target, const uint8_t source) const
+        {
+            return (hit_by[target] >> source) & 1u;
+        }
+        // Either can hit the other
+        bool interacts(const uint8_t a, const uint8_t b) const
+        {
+            return allows(a, b) == true || allows(b, a) == true;
+        }
+    private:
+        std::array<uint32_t, max_layers> hit_by;
+};
+
+enum class Broadphase
+{
+    Grid,
+    SweepAndPrune
+};
+
+// The shortest way from one position to another in a square world that
+// wraps at its edges, for positions in [0, world]
+inline float wrapped_delta(float d, const float world)
+{
+    if(d > world / 2)
+    {
+        d -= world;
+    }
+    else if(d < -world / 2)
+    {
+        d += world;
+    }
+    return d;
+}
+
+// Narrow phase, the square around each collider's radius, measured the
+// short way round the world so boxes overlap across its edges too
+// C needs entity, layer, x, y and radius members
+template<typename C>
+bool boxes_overlap(const C &first, const C &second, const float world)
+{
+    const float dx = wrapped_delta(first.x - second.x, world);
+    const float dy = wrapped_delta(first.y - second.y, world);
+    const float dist = first.radius + second.radius;
+    return std::fabs(dx) <= dist && std::fabs(dy) <= dist;
+}
+
+template<typename C>
+ColliderPair ordered_pair(const std::vector<C> &colliders, const uint32_t i, const uint32_t j)
+{
+    return colliders[i].entity < colliders[j].entity ? ColliderPair{i, j} : ColliderPair{j, i};
+}
+
+// Tests every pair, kept as the reference the broadphases are checked against
+template<typename C>
+void brute_force_pairs(const std::vector<C> &colliders, const float world, const CollisionMatrix &layers, std::vector<ColliderPair> &pairs)
+{
+    pairs.clear();
+    for(uint32_t i = 0; i < colliders.size(); ++i)
+    {
+        for(uint32_t j = i + 1; j < colliders.size(); ++j)
+        {
+            if(layers.interacts(colliders[i].layer, colliders[j].layer) == true && boxes_overlap(colliders[i], colliders[j], world) == true)
+            {
+                pairs.push_back(ordered_pair(colliders, i, j));
+            }
+        }
+    }
+}
+
+// Uniform grid over a square world that wraps at its edges
+// Every collider is put in each cell its box touches, with cell indices
+// taken modulo the grid, so a box hanging off one edge lands in the cells
+// on the other side too. Cells are counted, then filled, so the whole grid
+// is two flat arrays that are reused from frame to frame.
+// A pair sharing several cells is only tested in the one holding the
+// corner where their boxes' cell ranges start to overlap, going round the
+// grid's edges if need be, so it's tested and reported once.
+// The narrow phase is the same wrapping box test as brute_force_pairs(),
+// so both find exactly the same pairs.
+class SpatialHash
+{
+    public:
+        static const int max_dims = 128;
+
+        explicit SpatialHash(const float world_) : world(world_), dims(1), cell(world_), starts({}), items({}), fill({}), ranges({})
+        {
+            // The grid grows with the colliders, reserved so that doesn't allocate
+            starts.reserve(max_dims * max_dims + 1);
+            fill.reserve(max_dims * max_dims);
+        }
+        // Room for n colliders, a collider no bigger than a cell touches at
+        // most four cells
+        void reserve(const std::size_t n)
+        {
+            items.reserve(4 * n);
+            ranges.reserve(n);
+        }
+        // Picks a cell size for roughly two colliders per cell
+        template<typename C>
+        void build(const std::vector<C> &colliders)
+        {
+            const std::size_t n = colliders.size();
+            const int most = max_dims;
+            dims = std::max(1, std::min(most, static_cast<int>(std::sqrt(n / 2.0))));
+            cell = world / dims;
+
+            // Padded a little so rounding can't split a pair the box test accepts
+            const float pad = 1e-3f * cell;
+            ranges.resize(n);
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                const C &c = colliders[i];
+                Range &r = ranges[i];
+                r.x0 = static_cast<int>(std::floor((c.x - c.radius - pad) / cell));
+                r.y0 = static_cast<int>(std::floor((c.y - c.radius - pad) / cell));
+                r.w = std::min(dims, static_cast<int>(std::floor((c.x + c.radius + pad) / cell)) - r.x0 + 1);
+                r.h = std::min(dims, static_cast<int>(std::floor((c.y + c.radius + pad) / cell)) - r.y0 + 1);
+            }
+
+            starts.assign(dims * dims + 1, 0);
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                each_cell(ranges[i], [this](const int c) {starts[c + 1]++;});
+            }
+            for(int c = 0; c < dims * dims; ++c)
+            {
+                starts[c + 1] += starts[c];
+            }
+
+            items.resize(starts.back());
+            fill.assign(starts.begin(), starts.end() - 1);
+            for(uint32_t i = 0; i < n; ++i)
+            {
+                each_cell(ranges[i], [this, i](const int c) {items[fill[c]++] = i;});
+            }
+        }
+        // Every overlapping pair in colliders, which must be what build() saw
+        template<typename C>
+        void pairs(const std::vector<C> &colliders, const CollisionMatrix &layers, std::vector<ColliderPair> &out) const
+        {
+            out.clear();
+            for(int y = 0; y < dims; ++y)
+            {
+                for(int x = 0; x < dims; ++x)
+                {
+                    const int c = y * dims + x;
+                    for(uint32_t i = starts[c]; i < starts[c + 1]; ++i)
+                    {
+                        const uint32_t first = items[i];
+                        for(uint32_t j = i + 1; j < starts[c + 1]; ++j)
+                        {
+                            const uint32_t second = items[j];
+                            const Range &a = ranges[first];
+                            const Range &b = ranges[second];
+                            if(overlap_start(a.x0, b.x0, b.w) != x || overlap_start(a.y0, b.y0, b.h) != y)
+                            {
+                                continue;
+                            }
+
+                            if(layers.interacts(colliders[first].layer, colliders[second].layer) == false)
+                            {
+                                continue;
+                            }
+                            if(boxes_overlap(colliders[first], colliders[second], world) == true)
+                            {
+                                out.push_back(ordered_pair(colliders, first, second));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        int cells_per_side() const
+        {
+            return dims;
+        }
+    private:
+        // First cell and how many cells the box covers, before wrapping
+        struct Range
+        {
+            int x0;
+            int y0;
+            int w;
+            int h;
+        };
+        int wrap(const int i) const
+        {
+            const int m = i % dims;
+            return m < 0 ? m + dims : m;
+        }
+        // The cell where two wrapped cell ranges that share a cell start to
+        // overlap, the first of a's cells from a0 on that b covers
+        // If b runs on round the grid past a0 it's a0 itself, otherwise
+        // it's where b starts.
+        int overlap_start(const int a0, const int b0, const int bw) const
+        {
+            const int offset = wrap(b0 - a0);
+            return offset + bw > dims ? wrap(a0) : wrap(a0 + offset);
+        }
+        template<typename F>
+        void each_cell(const Range &r, F f) const
+        {
+            for(int y = 0; y < r.h; ++y)
+            {
+                const int row = wrap(r.y0 + y) * dims;
+                for(int x = 0; x < r.w; ++x)
+                {
+                    f(row + wrap(r.x0 + x));
+                }
+            }
+        }
+        float world;
+        int dims;
+        float cell;
+        std::vector<uint32_t> starts;
+        std::vector<uint32_t> items;
+        std::vector<uint32_t> fill;
+        std::vector<Range> ranges;
+};
+
+// Sort and sweep along x, keeping the sorted order from frame to frame
+// Colliders are matched up with last frame's order by entity, so when
+// things move a little between frames the order is nearly sorted already
+// and an insertion sort puts it right in close to O(n). New colliders are
+// sorted on their own and merged in. The sweep then only looks at
+// colliders whose x ranges overlap, filters them by layer, then by y the
+// short way round, then runs the same wrapping box test as
+// brute_force_pairs().
+// Pairs across the world's left and right edges are found by sweeping a
+// copy of every collider near the left edge, moved right by the world's
+// width, against the sorted order. Positions have to be in [0, world].
+class SweepAndPrune
+{
+    public:
+        explicit SweepAndPrune(const float world_) : world(world_), frame(0), moves(0), pad(0.0f), widest(0.0f), order({}), fresh({}), merged({}), ghosts({}), slots({}), seen({})
+        {
+        }
+        // Room for n colliders with entity indices up to n
+        void reserve(const std::size_t n)
+        {
+            order.reserve(n);
+            fresh.reserve(n);
+            merged.reserve(n);
+            ghosts.reserve(n);
+            slots.reserve(n + 1);
+            seen.reserve(n);
+        }
+        template<typename C>
+        void build(const std::vector<C> &colliders)
+        {
+            const uint32_t n = colliders.size();
+            frame++;
+
+            // Where each entity is in colliders this frame
+            float extent = 0.0f;
+            for(uint32_t i = 0; i < n; ++i)
+            {
+                const uint32_t index = entity_index(colliders[i].entity);
+                if(index >= slots.size())
+                {
+                    slots.resize(index + 1, Slot{invalid_entity, 0, 0});
+                }
+                slots[index] = Slot{colliders[i].entity, i, frame};
+                extent = std::max(extent, std::fabs(colliders[i].x) + std::fabs(colliders[i].y) + colliders[i].radius);
+            }
+
+            // Padded a little so rounding can't split a pair the box test accepts
+            pad = 1e-5f * extent;
+
+            // Refresh last frame's order, dropping colliders that have gone
+            seen.assign(n, false);
+            std::size_t kept = 0;
+            for(auto &entry : order)
+            {
+                const uint32_t index = entity_index(entry.entity);
+                const Slot &slot = slots[index];
+                if(slot.entity == entry.entity && slot.frame == frame)
+                {
+                    order[kept++] = make_entry(colliders, slot.index);
+                    seen[slot.index] = true;
+                }
+            }
+            order.resize(kept);
+
+            moves = 0;
+            for(std::size_t i = 1; i < order.size(); ++i)
+            {
+                const Entry entry = order[i];
+                std::size_t j = i;
+                for(; j > 0 && entry.min_x < order[j - 1].min_x; --j)
+                {
+                    order[j] = order[j - 1];
+                }
+                order[j] = entry;
+                moves += i - j;
+            }
+
+            fresh.clear();
+            for(uint32_t i = 0; i < n; ++i)
+            {
+                if(seen[i] == false)
+                {
+                    fresh.push_back(make_entry(colliders, i));
+                }
+            }
+            if(fresh.empty() == false)
+            {
+                // Merged into a spare array, inplace_merge would allocate
+                std::sort(fresh.begin(), fresh.end(), by_min_x);
+                merged.clear();
+                std::merge(order.begin(), order.end(), fresh.begin(), fresh.end(), std::back_inserter(merged), by_min_x);
+                order.swap(merged);
+            }
+
+            // Copies of everything that reaches past the right edge once
+            // moved right by the world's width, in order along x already
+            float reach = 0.0f;
+            widest = 0.0f;
+            for(const auto &entry : order)
+            {
+                reach = std::max(reach, entry.max_x);
+                widest = std::max(widest, entry.max_x - entry.min_x);
+            }
+            ghosts.clear();
+            for(const auto &entry : order)
+            {
+                if(entry.min_x + world > reach + pad)
+                {
+                    break;
+                }
+                Entry ghost = entry;
+                ghost.min_x += world;
+                ghost.max_x += world;
+                ghosts.push_back(ghost);
+            }
+        }
+        // Every overlapping pair in colliders, which must be what build() saw
+        template<typename C>
+        void pairs(const std::vector<C> &colliders, const CollisionMatrix &layers, std::vector<ColliderPair> &out) const
+        {
+            out.clear();
+            pairs(colliders, layers, out, 0, order.size());
+        }
+        // Appends the pairs whose first collider in sorted order is in
+        // [begin, end), so separate ranges can be swept on separate threads
+        // The range that ends the order also gets the pairs across the
+        // left and right edges, after its own.
+        template<typename C>
+        void pairs(const std::vector<C> &colliders, const CollisionMatrix &layers, std::vector<ColliderPair> &out, const std::size_t begin, const std::size_t end) const
+        {
+            for(std::size_t i = begin; i < end; ++i)
+            {
+                const Entry &a = order[i];
+                for(std::size_t j = i + 1; j < order.size() && order[j].min_x <= a.max_x + pad; ++j)
+                {
+                    const Entry &b = order[j];
+                    if(layers.interacts(a.layer, b.layer) == false)
+                    {
+                        continue;
+                    }
+                    if(test(colliders, a, b) == true)
+                    {
+                        out.push_back(ordered_pair(colliders, a.index, b.index));
+                    }
+                }
+            }
+            if(end != order.size())
+            {
+                return;
+            }
+
+            // Everything that overlaps each copy along x starts at most the
+            // widest box before it
+            for(const auto &ghost : ghosts)
+            {
+                auto first = std::lower_bound(order.begin(), order.end(), ghost.min_x - widest - pad, [](const Entry &e, const float x) {return e.min_x < x;});
+                for(auto it = first; it != order.end() && it->min_x <= ghost.max_x + pad; ++it)
+                {
+                    const Entry &b = *it;
+                    if(b.index == ghost.index || b.max_x + pad < ghost.min_x)
+                    {
+                        continue;
+                    }
+                    if(layers.interacts(ghost.layer, b.layer) == false)
+                    {
+                        continue;
+                    }
+                    if(test(colliders, ghost, b) == true)
+                    {
+                        out.push_back(ordered_pair(colliders, ghost.index, b.index));
+                    }
+                }
+            }
+        }
+        std::size_t size() const
+        {
+            return order.size();
+        }
+        // How far the insertion sort moved things in the last build()
+        std::size_t last_moves() const
+        {
+            return moves;
+        }
+    private:
+        struct Entry
+        {
+            float min_x;
+            float max_x;
+            float y;
+            float radius;
+            Entity entity;
+            uint32_t index;
+            uint8_t layer;
+        };
+        // The collider an entity index had in the frame it was last seen
+        struct Slot
+        {
+            Entity entity;
+            uint32_t index;
+            uint32_t frame;
+        };
+        static bool by_min_x(const Entry &a, const Entry &b)
+        {
+            return a.min_x < b.min_x;
+        }
+        template<typename C>
+        static Entry make_entry(const std::vector<C> &colliders, const uint32_t i)
+        {
+            const C &c = colliders[i];
+            return Entry{c.x - c.radius, c.x + c.radius, c.y, c.radius, c.entity, i, c.layer};
+        }
+        // Two colliders whose x ranges overlap, by y then the box test
+        template<typename C>
+        bool test(const std::vector<C> &colliders, const Entry &a, const Entry &b) const
+        {
+            if(std::fabs(wrapped_delta(a.y - b.y, world)) > a.radius + b.radius + pad)
+            {
+                return false;
+            }
+            return boxes_overlap(colliders[a.index], colliders[b.index], world);
+        }
+        float world;
+        uint32_t frame;
+        std::size_t moves;
+        float pad;
+        float widest;
+        std::vector<Entry> order;
+        std::vector<Entry> fresh;
+        std::vector<Entry> merged;
+        std::vector<Entry> ghosts;
+        std::vector<Slot> slots;
+        std::vector<bool> seen;
+};
+
+// Times the grid and sweep and prune against brute force on a mix of small
+// particles and a few larger rocks scattered over a 512x512 world that
+// wraps, and checks they agree. Rocks don't hit each other, like asteroids.
+// One in 32 is put right on an edge or corner so plenty of boxes hang
+// over the seams. Then moves everything a little, as a frame would, and
+// times both again, checking against brute force too up to 10k colliders.
+inline bool bench_broadphase(const std::vector<std::size_t> &sizes = {1000, 10000, 100000})
+{
+    struct Body
+    {
+        Entity entity;
+        uint8_t layer;
+        float x;
+        float y;
+        float radius;
+    };
+
+    typedef std::chrono::steady_clock Clock;
+    const auto ms = [](Clock::duration d) {return std::chrono::duration<double, std::milli>(d).count();};
+
+    const float world = 512.0f;
+    const auto wrap = [world](const float v) {return v > world ? v - world : (v < 0.0f ? v + world : v);};
+
+    CollisionMatrix layers;
+    layers.collide(0, 0);
+    layers.collide(0, 1);
+    layers.collide(0, 2);
+    layers.collide(1, 1);
+    layers.collide(1, 2);
+
+    bool ok = true;
+    for(std::size_t n : sizes)
+    {
+        srand(1);
+        std::vector<Body> bodies(n);
+        std::vector<float> vx(n);
+        std::vector<float> vy(n);
+        for(std::size_t i = 0; i < n; ++i)
+        {
+            const bool large = rand() % 10 == 0;
+            bodies[i] = Body{make_entity(i + 1, 1),
+                             static_cast<uint8_t>(large ? 2 : rand() % 2),
+                             (float)rand()/RAND_MAX * world,
+                             (float)rand()/RAND_MAX * world,
+                             large ? 5.0f + (float)rand()/RAND_MAX * 10.0f : 1.0f + (float)rand()/RAND_MAX * 2.0f};
+            // Within its radius of x = 0, y = 0 or both, either side
+            if(i % 32 == 0)
+            {
+                const float r = bodies[i].radius;
+                const int edge = rand() % 3;
+                if(edge != 1)
+                {
+                    bodies[i].x = wrap(((float)rand()/RAND_MAX * 2.0f - 1.0f) * r);
+                }
+                if(edge != 0)
+                {
+                    bodies[i].y = wrap(((float)rand()/RAND_MAX * 2.0f - 1.0f) * r);
+                }
+            }
+            vx[i] = ((float)rand()/RAND_MAX - 0.5f) * 2.0f;
+            vy[i] = ((float)rand()/RAND_MAX - 0.5f) * 2.0f;
+        }
+
+        std::vector<ColliderPair> brute;
+        std::vector<ColliderPair> grid;
+        std::vector<ColliderPair> sweep;
+        SpatialHash hash(world);
+        SweepAndPrune sap(world);
+
+        // Brute force is slow enough at 100k that one run will do
+        const int brute_runs = n > 10000 ? 1 : 3;
+        double brute_ms = 1e30;
+        for(int run = 0; run < brute_runs; ++run)
+        {
+            const auto start = Clock::now();
+            brute_force_pairs(bodies, world, layers, brute);
+            brute_ms = std::min(brute_ms, ms(Clock::now() - start));
+        }
+
+        double grid_ms = 1e30;
+        for(int run = 0; run < 5; ++run)
+        {
+            const auto start = Clock::now();
+            hash.build(bodies);
+            hash.pairs(bodies, layers, grid);
+            grid_ms = std::min(grid_ms, ms(Clock::now() - start));
+        }
+
+        // From nothing, so everything is sorted from scratch
+        double cold_ms = 1e30;
+        for(int run = 0; run < 5; ++run)
+        {
+            SweepAndPrune cold(world);
+            const auto start = Clock::now();
+            cold.build(bodies);
+            cold.pairs(bodies, layers, sweep);
+            cold_ms = std::min(cold_ms, ms(Clock::now() - start));
+        }
+        sap.build(bodies);
+
+        std::sort(brute.begin(), brute.end());
+        std::sort(grid.begin(), grid.end());
+        std::sort(sweep.begin(), sweep.end());
+        bool same = brute == grid && brute == sweep;
+
+        std::size_t seams = 0;
+        for(const auto &pair : brute)
+        {
+            const Body &a = bodies[pair.a];
+            const Body &b = bodies[pair.b];
+            seams += std::fabs(a.x - b.x) > world / 2 || std::fabs(a.y - b.y) > world / 2;
+        }
+
+        std::cout << n << " colliders, " << brute.size() << " pairs (" << seams << " across the edges): "
+                  << "brute force " << brute_ms << "ms, "
+                  << "grid " << grid_ms << "ms (" << hash.cells_per_side() << "x" << hash.cells_per_side() << "), "
+                  << "sweep and prune " << cold_ms << "ms"
+                  << (same ? "" : " MISMATCH") << std::endl;
+        ok = ok && same;
+
+        // A few frames of slow movement, the grid starts over every frame
+        // but sweep and prune only has to fix up last frame's order
+        double moved_grid_ms = 1e30;
+        double moved_sap_ms = 1e30;
+        std::size_t moves = 0;
+        for(int frame = 0; frame < 5; ++frame)
+        {
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                bodies[i].x = wrap(bodies[i].x + vx[i]);
+                bodies[i].y = wrap(bodies[i].y + vy[i]);
+            }
+
+            auto start = Clock::now();
+            hash.build(bodies);
+            hash.pairs(bodies, layers, grid);
+            moved_grid_ms = std::min(moved_grid_ms, ms(Clock::now() - start));
+
+            start = Clock::now();
+            sap.build(bodies);
+            sap.pairs(bodies, layers, sweep);
+            moved_sap_ms = std::min(moved_sap_ms, ms(Clock::now() - start));
+            moves += sap.last_moves();
+
+            std::sort(grid.begin(), grid.end());
+            std::sort(sweep.begin(), sweep.end());
+            same = same && grid == sweep;
+            if(n <= 10000)
+            {
+                brute_force_pairs(bodies, world, layers, brute);
+                std::sort(brute.begin(), brute.end());
+                same = same && brute == grid;
+            }
+        }
+
+        std::cout << "  moving: grid " << moved_grid_ms << "ms, "
+                  << "sweep and prune " << moved_sap_ms << "ms (" << moves / 5 << " moves a frame)"
+                  << (same ? "" : " MISMATCH") << std::endl;
+        ok = ok && same;
+    }
+    return ok;
+}
+
+#endif
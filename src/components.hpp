@@ -6,7 +6,7 @@
 
 #define RAND_BETWEEN(a, b) ((double)rand()/RAND_MAX * (b-a) + a)
 
-class Transform
+class Transform : public ComponentType<Transform>
 {
     public:
         Transform() : x(0.0), y(0.0), rotation(0.0)
@@ -15,14 +15,16 @@ class Transform
         Transform(float x, float y, float radians) : x(x), y(y), rotation(radians)
         {
         }
-        static const Component id;
         float x;
         float y;
         float rotation;
     private:
 };
 
-class Velocity
+// Hot in movement and collision, stored as x[], y[], rotation[]
+ECS_SOA3(Transform, x, y, rotation)
+
+class Velocity : public ComponentType<Velocity>
 {
     public:
         Velocity() : x(0.0), y(0.0)
@@ -31,25 +33,25 @@ class Velocity
         Velocity(float s, float dir) : x(s*cos(dir)), y(s*sin(dir))
         {
         }
-        static const Component id;
         float x;
         float y;
     private:
 };
 
-class Size
+ECS_SOA2(Velocity, x, y)
+
+class Size : public ComponentType<Size>
 {
     public:
         Size() : radius(1.0) {}
         explicit Size(float r) : radius(r)
         {
         }
-        static const Component id;
         float radius;
     private:
 };
 
-class Render
+class Render : public ComponentType<Render>
 {
     public:
         Render() : red(255), green(0), blue(0), alpha(255), texture(0)
@@ -61,7 +63,6 @@ class Render
         Render(int r, int g, int b) : red(r), green(g), blue(b), alpha(255), texture(0)
         {
         }
-        static const Component id;
         int red;
         int green;
         int blue;
@@ -70,13 +71,12 @@ class Render
     private:
 };
 
-class Inputs
+class Inputs : public ComponentType<Inputs>
 {
     public:
         Inputs() : left(false), right(false), up(false), down(false), use(false), mouse_x(0.0), mouse_y(0.0), selected(0)
         {
         }
-        static const Component id;
         bool left;
         bool right;
         bool up;
@@ -88,29 +88,27 @@ class Inputs
     private:
 };
 
-class Remove
+class Remove : public ComponentType<Remove>
 {
     public:
         Remove() : remove(false)
         {
         }
-        static const Component id;
         bool remove;
     private:
 };
 
-class Weapon
+class Weapon : public ComponentType<Weapon>
 {
     public:
         Weapon() : time_left(0.0)
         {
         }
-        static const Component id;
         float time_left;
     private:
 };
 
-class Timer
+class Timer : public ComponentType<Timer>
 {
     public:
         Timer() : time_left(3.0)
@@ -119,12 +117,13 @@ class Timer
         explicit Timer(float time_left) : time_left(time_left)
         {
         }
-        static const Component id;
         float time_left;
     private:
 };
 
-class Projectile
+ECS_SOA1(Timer, time_left)
+
+class Projectile : public ComponentType<Projectile>
 {
     public:
         Projectile() : owner(invalid_entity), damage(1)
@@ -133,13 +132,12 @@ class Projectile
         Projectile(Entity e, int damage) : owner(e), damage(damage)
         {
         }
-        static const Component id;
-        Entity owner;
+        Entity owner; // May be dead, check with EntityManager::alive()
         int damage;
     private:
 };
 
-class Rocket
+class Rocket : public ComponentType<Rocket>
 {
     public:
         Rocket() : owner(invalid_entity), damage(1), boost_time_left(1.0)
@@ -148,30 +146,34 @@ class Rocket
         Rocket(Entity e, int d, float t) : owner(e), damage(d), boost_time_left(t)
         {
         }
-        static const Component id;
-        Entity owner;
+        Entity owner; // May be dead, check with EntityManager::alive()
         int damage;
         float boost_time_left;
     private:
 };
 
-class Collision
+// Collision layers, which can hit which is set up in main
+enum CollisionLayer : uint8_t
+{
+    ShipLayer,
+    ProjectileLayer,
+    RockLayer
+};
+
+class Collision : public ComponentType<Collision>
 {
     public:
-        Collision() : collided(false), mask(0xFF)
+        Collision() : layer(ShipLayer)
         {
         }
-        Collision(uint8_t mask, bool self) : collided(false), mask(mask), self(self)
+        explicit Collision(uint8_t layer) : layer(layer)
         {
         }
-        static const Component id;
-        bool collided;
-        uint8_t mask;
-        bool self;
+        uint8_t layer;
     private:
 };
 
-class Health
+class Health : public ComponentType<Health>
 {
     public:
         Health() : start_health(1), health(1), immunity(0.0)
@@ -180,24 +182,24 @@ class Health
         explicit Health(int health) : start_health(health), health(health), immunity(0.0)
         {
         }
-        static const Component id;
         int start_health;
         int health;
         float immunity;
     private:
 };
 
-class Asteroid
+ECS_SOA3(Health, start_health, health, immunity)
+
+class Asteroid : public ComponentType<Asteroid>
 {
     public:
         Asteroid()
         {
         }
-        static const Component id;
     private:
 };
 
-class Trail
+class Trail : public ComponentType<Trail>
 {
     public:
         Trail()
@@ -206,14 +208,13 @@ class Trail
         Trail(int r, int g, int b) : red(r), green(g), blue(b)
         {
         }
-        static const Component id;
         int red;
         int green;
         int blue;
     private:
 };
 
-class Explode
+class Explode : public ComponentType<Explode>
 {
     public:
         Explode()
@@ -222,13 +223,12 @@ class Explode
         Explode(int r, int d) : radius(r), damage(d)
         {
         }
-        static const Component id;
         int radius;
         int damage;
     private:
 };
 
-class Fade
+class Fade : public ComponentType<Fade>
 {
     public:
         Fade() : fade_time(1.0), time(0.0)
@@ -237,74 +237,51 @@ class Fade
         Fade(float t) : fade_time(t), time(0.0)
         {
         }
-        static const Component id;
         float fade_time;
         float time;
     private:
 };
 
-class Player
+ECS_SOA2(Fade, fade_time, time)
+
+class Player : public ComponentType<Player>
 {
     public:
         Player()
         {
         }
-        static const Component id;
     private:
 };
 
-class AI
+class AI : public ComponentType<AI>
 {
     public:
         AI() : aggressive(true), timer(0.0)
         {
         }
-        static const Component id;
         bool aggressive;
         float timer;
     private:
 };
 
-class MineAI
+class MineAI : public ComponentType<MineAI>
 {
     public:
         MineAI() : aggressive(true), timer(0.0)
         {
         }
-        static const Component id;
         bool aggressive;
         float timer;
     private:
 };
 
-class Ship
+class Ship : public ComponentType<Ship>
 {
     public:
         Ship()
         {
         }
-        static const Component id;
     private:
 };
 
-const Component Transform::id = 0;
-const Component Velocity::id = 1;
-const Component Size::id = 2;
-const Component Render::id = 3;
-const Component Inputs::id = 4;
-const Component Weapon::id = 5;
-const Component Timer::id = 6;
-const Component Projectile::id = 7;
-const Component Collision::id = 8;
-const Component Health::id = 9;
-const Component Asteroid::id = 10;
-const Component Rocket::id = 11;
-const Component Trail::id = 12;
-const Component Explode::id = 13;
-const Component Fade::id = 14;
-const Component Player::id = 15;
-const Component AI::id = 16;
-const Component MineAI::id = 17;
-const Component Ship::id = 18;
-
 #endif
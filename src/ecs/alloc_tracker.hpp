@@ -0,0 +1,98 @@
+#ifndef ALLOC_TRACKER_HPP
+#define ALLOC_TRACKER_HPP
+
+// Build with -DECS_TRACK_ALLOCS to count heap allocations, in total and
+// per system. The counting happens in a replacement operator new, which
+// has to be defined in exactly one translation unit of the program:
+//
+// #include "alloc_tracker.hpp"
+// ECS_ALLOC_HOOKS
+
+#ifdef ECS_TRACK_ALLOCS
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+class AllocTotals
+{
+    public:
+        AllocTotals() : count(0), bytes(0)
+        {
+        }
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> bytes;
+};
+
+class AllocTracker
+{
+    public:
+        // Every allocation in the program
+        static AllocTotals& all()
+        {
+            static AllocTotals totals;
+            return totals;
+        }
+        // Where this thread's allocations are counted as well, if anywhere
+        static AllocTotals*& target()
+        {
+            static thread_local AllocTotals *current = nullptr;
+            return current;
+        }
+        static void note(const std::size_t bytes)
+        {
+            all().count.fetch_add(1, std::memory_order_relaxed);
+            all().bytes.fetch_add(bytes, std::memory_order_relaxed);
+            AllocTotals *t = target();
+            if(t != nullptr)
+            {
+                t->count.fetch_add(1, std::memory_order_relaxed);
+                t->bytes.fetch_add(bytes, std::memory_order_relaxed);
+            }
+        }
+        static void* allocate(const std::size_t bytes)
+        {
+            note(bytes);
+            void *p = std::malloc(bytes == 0 ? 1 : bytes);
+            if(p == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            return p;
+        }
+};
+
+// Allocations count towards t until the end of the scope
+class AllocScope
+{
+    public:
+        explicit AllocScope(AllocTotals *t) : previous(AllocTracker::target())
+        {
+            AllocTracker::target() = t;
+        }
+        AllocScope(const AllocScope&) = delete;
+        AllocScope& operator=(const AllocScope&) = delete;
+        ~AllocScope()
+        {
+            AllocTracker::target() = previous;
+        }
+    private:
+        AllocTotals *previous;
+};
+
+#define ECS_ALLOC_HOOKS \
+    void* operator new(std::size_t bytes) {return AllocTracker::allocate(bytes);} \
+    void* operator new[](std::size_t bytes) {return AllocTracker::allocate(bytes);} \
+    void operator delete(void *p) noexcept {std::free(p);} \
+    void operator delete[](void *p) noexcept {std::free(p);} \
+    void operator delete(void *p, std::size_t) noexcept {std::free(p);} \
+    void operator delete[](void *p, std::size_t) noexcept {std::free(p);}
+
+#else
+
+#define ECS_ALLOC_HOOKS
+
+#endif
+
+#endif
@@ -0,0 +1,889 @@
+#ifndef ARCHETYPE_MANAGER_HPP
+#define ARCHETYPE_MANAGER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "component_type.hpp"
+#include "entity.hpp"
+#include "thread_pool.hpp"
+#include "view.hpp"
+
+
+// Archetype storage
+// Entities with exactly the same set of components share an archetype. The
+// archetype keeps them in fixed size chunks with one column per component, so
+// a query over several components walks columns that line up row for row.
+// Adding or removing a component moves the entity to a different archetype.
+// Change tracking is per chunk and column: writing one entity's component
+// marks its whole chunk as changed, and moving an entity between archetypes
+// counts as a write.
+
+// Type erased operations needed to shuffle components between chunks
+struct ComponentInfo
+{
+    std::size_t size;
+    std::size_t align;
+    void (*move)(void *dst, void *src);
+    void (*destroy)(void *ptr);
+};
+
+template<typename T>
+ComponentInfo component_info()
+{
+    ComponentInfo info;
+    info.size = sizeof(T);
+    info.align = alignof(T);
+    info.move = [](void *dst, void *src)
+    {
+        new(dst) T(std::move(*static_cast<T*>(src)));
+        static_cast<T*>(src)->~T();
+    };
+    info.destroy = [](void *ptr)
+    {
+        static_cast<T*>(ptr)->~T();
+    };
+    return info;
+}
+
+class Chunk
+{
+    public:
+        static const std::size_t bytes = 16 * 1024;
+
+        Chunk() : data(new unsigned char[bytes])
+        {
+        }
+        std::unique_ptr<unsigned char[]> data;
+};
+
+// Empty chunks shared by every archetype
+// Archetypes hand back the chunks they empty and take them again before
+// anything new is allocated, so once there are enough for the most entities
+// alive at once, entities coming, going and moving don't allocate.
+class ChunkPool
+{
+    public:
+        ChunkPool() : spare(), total(0)
+        {
+        }
+        std::unique_ptr<Chunk> take()
+        {
+            if(spare.empty() == true)
+            {
+                grow(1);
+            }
+            std::unique_ptr<Chunk> chunk = std::move(spare.back());
+            spare.pop_back();
+            return chunk;
+        }
+        void give(std::unique_ptr<Chunk> chunk)
+        {
+            spare.push_back(std::move(chunk));
+        }
+        // Every chunk allocated, in use or not
+        std::size_t size() const
+        {
+            return total;
+        }
+        // Allocates n more chunks, with room to hand every chunk back
+        void grow(const std::size_t n)
+        {
+            total += n;
+            if(spare.capacity() < total)
+            {
+                spare.reserve(2 * total);
+            }
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                spare.emplace_back(new Chunk());
+            }
+        }
+    private:
+        std::vector<std::unique_ptr<Chunk>> spare;
+        std::size_t total;
+};
+
+class Archetype
+{
+    public:
+        Archetype(const Signature &types_, const std::array<ComponentInfo, MAX_COMPONENTS> &all_infos, ChunkPool &pool_) : types(types_), size(0), pool(pool_)
+        {
+            column_of.fill(-1);
+
+            std::size_t row_bytes = sizeof(Entity);
+            for(Component c = 0; c < MAX_COMPONENTS; ++c)
+            {
+                if(types.test(c) == false)
+                {
+                    continue;
+                }
+                components.push_back(c);
+                infos.push_back(all_infos[c]);
+                row_bytes += infos.back().size;
+                column_of[c] = infos.size() - 1;
+            }
+
+            // Shrink until the columns fit with their alignment padding
+            capacity = Chunk::bytes / row_bytes;
+            while(layout() > Chunk::bytes)
+            {
+                capacity--;
+            }
+            assert(capacity > 0);
+        }
+        int column(const Component c) const
+        {
+            return column_of[c];
+        }
+        Entity* entities(const std::size_t chunk)
+        {
+            return reinterpret_cast<Entity*>(chunks[chunk]->data.get());
+        }
+        void* get(const int col, const std::size_t row)
+        {
+            return chunks[row / capacity]->data.get() + offsets[col] + (row % capacity) * infos[col].size;
+        }
+        // nullptr if this archetype doesn't have T
+        template<typename T>
+        T* column_data(const std::size_t chunk)
+        {
+            const int col = column(T::id);
+            if(col < 0)
+            {
+                return nullptr;
+            }
+            return reinterpret_cast<T*>(chunks[chunk]->data.get() + offsets[col]);
+        }
+        // Rows are packed, only the last chunk can be partially full
+        std::size_t chunk_count() const
+        {
+            return (size + capacity - 1) / capacity;
+        }
+        std::size_t chunk_size(const std::size_t chunk) const
+        {
+            const std::size_t start = chunk * capacity;
+            return size - start < capacity ? size - start : capacity;
+        }
+        std::size_t push(const Entity e)
+        {
+            if(size == chunks.size() * capacity)
+            {
+                add_chunk();
+            }
+            const std::size_t row = size++;
+            entities(row / capacity)[row % capacity] = e;
+            return row;
+        }
+        void add_chunk()
+        {
+            chunks.push_back(pool.take());
+            versions.resize(chunks.size() * components.size(), 0);
+        }
+        // Returns empty chunks to the pool, keeping one so a row coming and
+        // going at a chunk boundary doesn't pass one back and forth
+        void release_chunks()
+        {
+            while(chunks.size() > chunk_count() + 1)
+            {
+                pool.give(std::move(chunks.back()));
+                chunks.pop_back();
+            }
+            versions.resize(chunks.size() * components.size());
+        }
+        // Room to hold n rows without the chunk list growing
+        void reserve(const std::size_t n)
+        {
+            chunks.reserve(n / capacity + 2);
+            versions.reserve((n / capacity + 2) * components.size());
+        }
+        void mark(const std::size_t chunk, const int col, const Tick tick)
+        {
+            versions[chunk * components.size() + col] = tick;
+        }
+        // Marks every column of the chunk holding row
+        void mark_row(const std::size_t row, const Tick tick)
+        {
+            for(std::size_t col = 0; col < components.size(); ++col)
+            {
+                mark(row / capacity, col, tick);
+            }
+        }
+        // Keeps the newer of the two chunks' ticks when a row moves between them
+        void merge_version(const std::size_t to, const std::size_t from, const int col)
+        {
+            const Tick t = version(from, col);
+            if(tick_newer(t, version(to, col)) == true)
+            {
+                mark(to, col, t);
+            }
+        }
+        Tick version(const std::size_t chunk, const int col) const
+        {
+            return versions[chunk * components.size() + col];
+        }
+        // Whether every column in changes was written to after since
+        bool chunk_changed(const std::size_t chunk, const Signature &changes, const Tick since) const
+        {
+            bool changed = true;
+            each_component(changes, [&](Component c)
+            {
+                changed = changed && tick_newer(version(chunk, column(c)), since);
+            });
+            return changed;
+        }
+        Signature types;
+        std::vector<Component> components;
+        std::vector<ComponentInfo> infos;
+        std::vector<std::size_t> offsets;
+        std::array<int, MAX_COMPONENTS> column_of;
+        std::size_t capacity;
+        std::size_t size;
+        std::vector<std::unique_ptr<Chunk>> chunks;
+        // Last written tick, one per chunk per column
+        std::vector<Tick> versions;
+        std::unordered_map<Component, Archetype*> add_edges;
+        std::unordered_map<Component, Archetype*> remove_edges;
+    private:
+        ChunkPool &pool;
+        std::size_t layout()
+        {
+            offsets.clear();
+            std::size_t offset = capacity * sizeof(Entity);
+            for(auto &info : infos)
+            {
+                offset = (offset + info.align - 1) / info.align * info.align;
+                offsets.push_back(offset);
+                offset += capacity * info.size;
+            }
+            return offset;
+        }
+};
+
+struct EntityLocation
+{
+    Archetype *archetype;
+    std::size_t row;
+};
+
+// Archetype and chunk pairs for parallel_each() to hand out
+// Reused rather than built fresh every call. There's one per call running
+// on a thread rather than one per thread, because a thread waiting on its
+// tasks can pick up another system's parallel_each().
+class ChunkList
+{
+    public:
+        // Room for most chunks, so a list only grows along with the pool
+        explicit ChunkList(const std::size_t most) : chunks(take())
+        {
+            chunks.clear();
+            chunks.reserve(most);
+        }
+        ChunkList(const ChunkList&) = delete;
+        ChunkList& operator=(const ChunkList&) = delete;
+        ~ChunkList()
+        {
+            depth()--;
+        }
+        std::vector<std::pair<Archetype*, std::size_t>> &chunks;
+    private:
+        static std::vector<std::pair<Archetype*, std::size_t>>& take()
+        {
+            static thread_local std::vector<std::unique_ptr<std::vector<std::pair<Archetype*, std::size_t>>>> lists;
+            if(depth() == lists.size())
+            {
+                lists.emplace_back(new std::vector<std::pair<Archetype*, std::size_t>>());
+            }
+            return *lists[depth()++];
+        }
+        static std::size_t& depth()
+        {
+            static thread_local std::size_t calls = 0;
+            return calls;
+        }
+};
+
+class ArchetypeStorage
+{
+    public:
+        ArchetypeStorage() : tick(1), infos(), registered(), chunk_pool(), reserved(0), archetypes(), archetype_list({}), locations({})
+        {
+        }
+        void set_tick(const Tick t)
+        {
+            tick = t;
+        }
+        template<typename T>
+        void register_component()
+        {
+            infos[T::id] = component_info<T>();
+            registered.set(T::id);
+        }
+        template<typename T>
+        void add(const Entity e, T t)
+        {
+            EntityLocation &loc = location(e);
+            if(loc.archetype != nullptr && loc.archetype->column(T::id) >= 0)
+            {
+                const int col = loc.archetype->column(T::id);
+                *static_cast<T*>(loc.archetype->get(col, loc.row)) = t;
+                loc.archetype->mark(loc.row / loc.archetype->capacity, col, tick);
+                return;
+            }
+
+            Archetype *target = with(loc.archetype, T::id);
+            move_entity(e, target);
+            new(target->get(target->column(T::id), loc.row)) T(t);
+        }
+        // Places a new entity straight into the archetype for all of Ts
+        template<typename... Ts>
+        void insert(const Entity e, const std::tuple<Ts...> &components)
+        {
+            EntityLocation &loc = location(e);
+            if(alive(e) == true)
+            {
+                const int expand[] = {0, (add<Ts>(e, std::get<Ts>(components)), 0)...};
+                (void)expand;
+                return;
+            }
+
+            Archetype *target = find(components_signature<Ts...>());
+            const std::size_t row = target->push(e);
+            loc = EntityLocation{target, row};
+            target->mark_row(row, tick);
+
+            const int expand[] = {0, (new(target->get(target->column(Ts::id), row)) Ts(std::get<Ts>(components)), 0)...};
+            (void)expand;
+        }
+        // Allocates the chunks n more entities with exactly Ts will need
+        template<typename... Ts>
+        void reserve(const std::size_t n)
+        {
+            Archetype *a = find(components_signature<Ts...>());
+            while(a->chunks.size() * a->capacity < a->size + n)
+            {
+                a->add_chunk();
+            }
+        }
+        // Room for n entities at once, call it once every component exists
+        // The pool gets enough chunks for n rows of the widest archetype
+        // there could be, and each archetype, now or once it's made, two
+        // more for its part full last chunk and the empty one it keeps.
+        void reserve(const std::size_t n)
+        {
+            locations.reserve(n + 1);
+            reserved = n;
+
+            const Archetype widest(registered, infos, chunk_pool);
+            chunk_pool.grow(n / widest.capacity + 1 + 2 * archetype_list.size());
+            for(auto a : archetype_list)
+            {
+                a->reserve(n);
+            }
+        }
+        // Makes every archetype and edge an entity with types passes
+        // through while a command buffer adds its components one at a time,
+        // which it does in component order
+        void prepare(const Signature &types)
+        {
+            Archetype *a = nullptr;
+            each_component(types, [this, &a](Component c)
+            {
+                a = with(a, c);
+            });
+        }
+        void remove(const Entity e, const Component c)
+        {
+            if(alive(e) == false)
+            {
+                return;
+            }
+
+            EntityLocation &loc = location(e);
+            if(loc.archetype->column(c) < 0)
+            {
+                return;
+            }
+
+            Archetype *target = without(loc.archetype, c);
+            if(target == nullptr)
+            {
+                destroy(e);
+                return;
+            }
+            move_entity(e, target);
+        }
+        void destroy(const Entity e)
+        {
+            if(alive(e) == false)
+            {
+                return;
+            }
+
+            EntityLocation &loc = location(e);
+            Archetype *a = loc.archetype;
+            for(std::size_t col = 0; col < a->infos.size(); ++col)
+            {
+                a->infos[col].destroy(a->get(col, loc.row));
+            }
+            remove_row(a, loc.row);
+            loc.archetype = nullptr;
+        }
+        // Marks the component's chunk as changed
+        template<typename T>
+        T* get(const Entity e)
+        {
+            if(alive(e) == false)
+            {
+                return nullptr;
+            }
+            const EntityLocation &loc = locations[entity_index(e)];
+            const int col = loc.archetype->column(T::id);
+            if(col < 0)
+            {
+                return nullptr;
+            }
+            loc.archetype->mark(loc.row / loc.archetype->capacity, col, tick);
+            return static_cast<T*>(loc.archetype->get(col, loc.row));
+        }
+        template<typename T>
+        const T* read(const Entity e) const
+        {
+            if(alive(e) == false)
+            {
+                return nullptr;
+            }
+            const EntityLocation &loc = locations[entity_index(e)];
+            const int col = loc.archetype->column(T::id);
+            if(col < 0)
+            {
+                return nullptr;
+            }
+            return static_cast<const T*>(loc.archetype->get(col, loc.row));
+        }
+        bool has(const Entity e, const Component c) const
+        {
+            if(alive(e) == false)
+            {
+                return false;
+            }
+            return locations[entity_index(e)].archetype->column(c) >= 0;
+        }
+        const Signature& signature(const Entity e) const
+        {
+            static const Signature none;
+            if(alive(e) == false)
+            {
+                return none;
+            }
+            return locations[entity_index(e)].archetype->types;
+        }
+        std::size_t count(const Component c) const
+        {
+            std::size_t n = 0;
+            for(auto a : archetype_list)
+            {
+                if(a->column(c) >= 0)
+                {
+                    n += a->size;
+                }
+            }
+            return n;
+        }
+        // Calls f(e, Ts&...) for every entity with all of Ts and none of exclude
+        // Walks matching archetypes a chunk at a time, last row first
+        // Chunks without a newer tick for each of changes are skipped, and
+        // the columns handed out for writing are marked once per chunk.
+        template<typename... Ts, typename F>
+        void each(const Signature &exclude, const Signature &changes, const Tick since, F f)
+        {
+            const Signature include = view_signature<Ts...>() | changes;
+
+            const std::size_t num_archetypes = archetype_list.size();
+            for(std::size_t i = 0; i < num_archetypes; ++i)
+            {
+                Archetype *a = archetype_list[i];
+                if((a->types & include) != include || (a->types & exclude).any())
+                {
+                    continue;
+                }
+
+                for(std::size_t chunk = a->chunk_count(); chunk-- > 0;)
+                {
+                    each_row<Ts...>(a, chunk, changes, since, f);
+                }
+            }
+        }
+        // Same as each() but chunks are handed out to the pool, f has to be
+        // safe to call from several threads at once
+        // Each chunk's tick is only marked by the thread walking it.
+        template<typename... Ts, typename F>
+        void parallel_each(ThreadPool &pool, const std::size_t grain, const Signature &exclude, const Signature &changes, const Tick since, F f)
+        {
+            const Signature include = view_signature<Ts...>() | changes;
+
+            ChunkList list(chunk_pool.size());
+            std::vector<std::pair<Archetype*, std::size_t>> &chunks = list.chunks;
+            std::size_t rows = 0;
+            for(auto a : archetype_list)
+            {
+                if((a->types & include) != include || (a->types & exclude).any())
+                {
+                    continue;
+                }
+                for(std::size_t chunk = a->chunk_count(); chunk-- > 0;)
+                {
+                    chunks.emplace_back(a, chunk);
+                }
+                rows += a->size;
+            }
+
+            const std::size_t per_task = rows <= grain || chunks.empty() ? chunks.size() : std::max<std::size_t>(1, grain * chunks.size() / rows);
+            pool.parallel_for(chunks.size(), per_task, [&](const std::size_t begin, const std::size_t end)
+            {
+                for(std::size_t i = begin; i < end; ++i)
+                {
+                    each_row<Ts...>(chunks[i].first, chunks[i].second, changes, since, f);
+                }
+            });
+        }
+        void print()
+        {
+            std::cout << "  Archetypes:" << std::endl;
+            for(auto a : archetype_list)
+            {
+                std::cout << "    {";
+                for(auto c : a->components)
+                {
+                    std::cout << " " << c;
+                }
+                std::cout << " }: " << a->size << " entities, " << a->chunk_count() << " chunks of " << a->capacity << std::endl;
+            }
+        }
+    private:
+        // One chunk of an archetype that has all of Ts, last row first
+        // Skipped if it hasn't a newer tick for each of changes, and the
+        // columns handed out for writing are marked once.
+        template<typename... Ts, typename F>
+        void each_row(Archetype *a, const std::size_t chunk, const Signature &changes, const Tick since, F &f)
+        {
+            if(changes.any() && a->chunk_changed(chunk, changes, since) == false)
+            {
+                return;
+            }
+
+            const int marks[] = {0, (ViewArg<Ts>::writes ? mark_column(a, chunk, ViewArg<Ts>::component::id) : 0)...};
+            (void)marks;
+
+            Entity *entities = a->entities(chunk);
+            std::tuple<typename ViewArg<Ts>::value*...> columns(a->column_data<typename ViewArg<Ts>::component>(chunk)...);
+
+            for(std::size_t row = a->chunk_size(chunk); row-- > 0;)
+            {
+                f(entities[row], ViewArg<Ts>::get(at(std::get<typename ViewArg<Ts>::value*>(columns), row))...);
+            }
+        }
+        template<typename T>
+        static T* at(T *column, const std::size_t row)
+        {
+            return column == nullptr ? nullptr : column + row;
+        }
+        int mark_column(Archetype *a, const std::size_t chunk, const Component c)
+        {
+            const int col = a->column(c);
+            if(col >= 0)
+            {
+                a->mark(chunk, col, tick);
+            }
+            return 0;
+        }
+        EntityLocation& location(const Entity e)
+        {
+            const uint32_t index = entity_index(e);
+            if(index >= locations.size())
+            {
+                locations.resize(index + 1, EntityLocation{nullptr, 0});
+            }
+            return locations[index];
+        }
+        // Also compares the stored handle so a stale generation isn't found
+        bool alive(const Entity e) const
+        {
+            const uint32_t index = entity_index(e);
+            if(index >= locations.size() || locations[index].archetype == nullptr)
+            {
+                return false;
+            }
+            Archetype *a = locations[index].archetype;
+            const std::size_t row = locations[index].row;
+            return a->entities(row / a->capacity)[row % a->capacity] == e;
+        }
+        Archetype* find(const Signature &types)
+        {
+            auto &a = archetypes[types];
+            if(a == nullptr)
+            {
+                a.reset(new Archetype(types, infos, chunk_pool));
+                archetype_list.push_back(a.get());
+                if(reserved > 0)
+                {
+                    a->reserve(reserved);
+                    chunk_pool.grow(2);
+                }
+            }
+            return a.get();
+        }
+        Archetype* with(Archetype *from, const Component c)
+        {
+            if(from == nullptr)
+            {
+                Signature types;
+                types.set(c);
+                return find(types);
+            }
+
+            auto edge = from->add_edges.find(c);
+            if(edge != from->add_edges.end())
+            {
+                return edge->second;
+            }
+
+            Signature types = from->types;
+            types.set(c);
+            Archetype *to = find(types);
+            from->add_edges[c] = to;
+            to->remove_edges[c] = from;
+            return to;
+        }
+        Archetype* without(Archetype *from, const Component c)
+        {
+            if(from->types.count() == 1)
+            {
+                return nullptr;
+            }
+
+            auto edge = from->remove_edges.find(c);
+            if(edge != from->remove_edges.end())
+            {
+                return edge->second;
+            }
+
+            Signature types = from->types;
+            types.reset(c);
+            Archetype *to = find(types);
+            from->remove_edges[c] = to;
+            to->add_edges[c] = from;
+            return to;
+        }
+        // Move every column the target shares, destroy the rest
+        void move_entity(const Entity e, Archetype *target)
+        {
+            EntityLocation &loc = locations[entity_index(e)];
+            const EntityLocation old = loc;
+            const std::size_t row = target->push(e);
+
+            if(old.archetype != nullptr)
+            {
+                Archetype *a = old.archetype;
+                for(std::size_t col = 0; col < a->infos.size(); ++col)
+                {
+                    const int target_col = target->column(a->components[col]);
+                    if(target_col >= 0)
+                    {
+                        a->infos[col].move(target->get(target_col, row), a->get(col, old.row));
+                    }
+                    else
+                    {
+                        a->infos[col].destroy(a->get(col, old.row));
+                    }
+                }
+                remove_row(a, old.row);
+            }
+
+            loc = EntityLocation{target, row};
+            target->mark_row(row, tick);
+        }
+        // Fill the hole left at row with the archetype's last row
+        void remove_row(Archetype *a, const std::size_t row)
+        {
+            const std::size_t last = a->size - 1;
+            if(row != last)
+            {
+                for(std::size_t col = 0; col < a->infos.size(); ++col)
+                {
+                    a->infos[col].move(a->get(col, row), a->get(col, last));
+                    a->merge_version(row / a->capacity, last / a->capacity, col);
+                }
+                const Entity moved = a->entities(last / a->capacity)[last % a->capacity];
+                a->entities(row / a->capacity)[row % a->capacity] = moved;
+                locations[entity_index(moved)].row = row;
+            }
+            a->size--;
+            a->release_chunks();
+        }
+        Tick tick;
+        std::array<ComponentInfo, MAX_COMPONENTS> infos;
+        Signature registered;
+        ChunkPool chunk_pool;
+        // Entities reserve() made room for, new archetypes get as much
+        std::size_t reserved;
+        std::unordered_map<Signature, std::unique_ptr<Archetype>> archetypes;
+        std::vector<Archetype*> archetype_list;
+        std::vector<EntityLocation> locations;
+};
+
+class ArchetypeStoreBase
+{
+    public:
+        virtual ~ArchetypeStoreBase() = default;
+        virtual void remove_entity(const Entity e) = 0;
+};
+
+// Gives systems the same get_store<T>() interface as ComponentStore<T>
+template<typename T>
+class ArchetypeStore : public ArchetypeStoreBase
+{
+    public:
+        explicit ArchetypeStore(ArchetypeStorage &s) : ArchetypeStoreBase(), storage(s)
+        {
+        }
+        void add_entity(const Entity e, T t)
+        {
+            storage.add<T>(e, t);
+        }
+        void remove_entity(const Entity e)
+        {
+            storage.remove(e, T::id);
+        }
+        T* get_component(const Entity e)
+        {
+            return storage.get<T>(e);
+        }
+        const T* read_component(const Entity e) const
+        {
+            return storage.read<T>(e);
+        }
+        bool has(const Entity e) const
+        {
+            return storage.has(e, T::id);
+        }
+        std::size_t size() const
+        {
+            return storage.count(T::id);
+        }
+    private:
+        ArchetypeStorage &storage;
+};
+
+// Drop in replacement for ComponentManager backed by archetypes
+class ArchetypeComponentManager
+{
+    public:
+        ArchetypeComponentManager()
+        {
+        }
+        void print()
+        {
+            std::cout << "ArchetypeComponentManager:" << std::endl;
+
+            storage.print();
+        }
+        template<typename T>
+        void add_component()
+        {
+            storage.register_component<T>();
+            stores[T::id].reset(static_cast<ArchetypeStoreBase*>(new ArchetypeStore<T>(storage)));
+        }
+        void remove_entity(const Entity e)
+        {
+            storage.destroy(e);
+        }
+        // Each destroy already only touches the entity's own archetype
+        void remove_entities(const std::vector<Entity> &es)
+        {
+            for(auto e : es)
+            {
+                storage.destroy(e);
+            }
+        }
+        template<typename T>
+        ArchetypeStore<T>& get_store()
+        {
+            return static_cast<ArchetypeStore<T>&>(*stores[T::id]);
+        }
+        template<typename T>
+        void add_entity_component(const Entity e, T t)
+        {
+            storage.add<T>(e, t);
+        }
+        // Moves the entity to the archetype without c
+        void remove_entity_component(const Entity e, const Component c)
+        {
+            storage.remove(e, c);
+        }
+        template<typename... Ts>
+        void reserve_more(const std::size_t n)
+        {
+            storage.reserve<Ts...>(n);
+        }
+        void reserve(const std::size_t n)
+        {
+            storage.reserve(n);
+        }
+        template<typename... Ts>
+        void prepare()
+        {
+            storage.prepare(components_signature<Ts...>());
+        }
+        template<typename... Ts>
+        void add_entity_components(const Entity e, const std::tuple<Ts...> &components)
+        {
+            storage.insert<Ts...>(e, components);
+        }
+        const Signature& signature(const Entity e) const
+        {
+            return storage.signature(e);
+        }
+        bool entity_has_component(const Entity e, const Component c) const
+        {
+            return storage.has(e, c);
+        }
+        void set_tick(const Tick t)
+        {
+            storage.set_tick(t);
+        }
+        template<typename... Ts, typename F>
+        void each(const Signature &exclude, const Signature &changes, const Tick since, F f)
+        {
+            storage.each<Ts...>(exclude, changes, since, f);
+        }
+        template<typename... Ts, typename F>
+        void each(const Signature &exclude, F f)
+        {
+            storage.each<Ts...>(exclude, Signature(), 0, f);
+        }
+        template<typename... Ts, typename F>
+        void parallel_each(ThreadPool &pool, const std::size_t grain, const Signature &exclude, const Signature &changes, const Tick since, F f)
+        {
+            storage.parallel_each<Ts...>(pool, grain, exclude, changes, since, f);
+        }
+        template<typename... Ts, typename F>
+        void each(F f)
+        {
+            storage.each<Ts...>(Signature(), Signature(), 0, f);
+        }
+        // Indexed by ComponentType<T>::id
+        std::array<std::unique_ptr<ArchetypeStoreBase>, MAX_COMPONENTS> stores;
+        ArchetypeStorage storage;
+    private:
+};
+
+#endif
@@ -0,0 +1,435 @@
+#ifndef COMMAND_BUFFER_HPP
+#define COMMAND_BUFFER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "entity.hpp"
+#include "entity_manager.hpp"
+#include "observer.hpp"
+#include "prefab.hpp"
+#include "profiler.hpp"
+#include "system_manager.hpp"
+#include "thread_pool.hpp"
+
+// Component adds waiting for a flush, one queue per component type
+template<typename Backend>
+class CommandQueue
+{
+    public:
+        virtual ~CommandQueue() = default;
+        virtual void apply(Backend &cm, const EntityManager &em, std::vector<Entity> &touched, std::vector<Entity> &added, std::vector<Entity> &replaced) = 0;
+        virtual bool empty() const = 0;
+        virtual void reserve(const std::size_t n) = 0;
+};
+
+template<typename Backend, typename T>
+class AddQueue : public CommandQueue<Backend>
+{
+    public:
+        AddQueue() : items({}), order({})
+        {
+        }
+        // In entity order so the sparse index is walked front to back
+        // Adds to the same entity keep the order they were recorded in, so
+        // the last one wins. Sorting positions rather than the items does
+        // that without stable_sort's temporary buffer. Entities that died
+        // since the add was recorded are skipped.
+        void apply(Backend &cm, const EntityManager &em, std::vector<Entity> &touched, std::vector<Entity> &added, std::vector<Entity> &replaced)
+        {
+            order.resize(items.size());
+            for(uint32_t i = 0; i < order.size(); ++i)
+            {
+                order[i] = i;
+            }
+            std::sort(order.begin(), order.end(), [this](const uint32_t a, const uint32_t b)
+            {
+                const uint32_t x = entity_index(items[a].first);
+                const uint32_t y = entity_index(items[b].first);
+                return x < y || (x == y && a < b);
+            });
+
+            for(auto i : order)
+            {
+                const std::pair<Entity, T> &item = items[i];
+                if(em.alive(item.first) == true)
+                {
+                    const bool replacing = cm.entity_has_component(item.first, T::id);
+                    cm.add_entity_component(item.first, item.second);
+                    touched.push_back(item.first);
+                    (replacing == true ? replaced : added).push_back(item.first);
+                }
+            }
+            items.clear();
+        }
+        bool empty() const
+        {
+            return items.empty();
+        }
+        void reserve(const std::size_t n)
+        {
+            items.reserve(n);
+            order.reserve(n);
+        }
+        std::vector<std::pair<Entity, T>> items;
+    private:
+        std::vector<uint32_t> order;
+};
+
+// Structural changes recorded while systems run and applied later
+// Systems can't safely create entities, add or remove components or destroy
+// entities in the middle of a view, so they record it here instead. flush() applies
+// everything in one go: adds grouped by store, systems matched once per
+// touched entity, then removes, and finally the destroys in bulk. Observers
+// are told about each step with every entity it affected.
+// New entities get their ids straight away so more can be added to them
+// before the flush, but they have no components until then.
+// Each thread in the pool records into its own buffer, so systems running
+// in parallel can record without locking anything but the entity ids.
+// The buffers are applied in thread order.
+template<typename Backend>
+class CommandBuffer
+{
+    public:
+        explicit CommandBuffer(EntityManager &em_) : em(em_), pool(nullptr), recordings(), makers(), reserved(0), ids(), touched({}), added(), replaced(), working({}), watched({})
+        {
+            recordings.emplace_back(new Recording());
+        }
+        CommandBuffer(const CommandBuffer&) = delete;
+        CommandBuffer& operator=(const CommandBuffer&) = delete;
+        // One buffer per thread in p, call it before any threads record
+        void set_pool(ThreadPool *p)
+        {
+            pool = p;
+            while(recordings.size() < (pool == nullptr ? 1 : pool->size()))
+            {
+                recordings.emplace_back(new Recording());
+                setup(*recordings.back());
+            }
+        }
+        // Gives every thread's buffer a queue for T now rather than on its
+        // first add, so reserve() can size it
+        template<typename T>
+        void add_component()
+        {
+            makers[T::id] = &make_queue<T>;
+            for(auto &r : recordings)
+            {
+                setup(*r);
+            }
+        }
+        // Room for n of each kind of change in a frame, i.e. n entities
+        // created, n destroyed and n adds and n removes of each component,
+        // whether they all come from one thread or not
+        void reserve(const std::size_t n)
+        {
+            reserved = n;
+            for(auto &r : recordings)
+            {
+                setup(*r);
+            }
+
+            touched.reserve(n * std::count_if(makers.begin(), makers.end(), [](const Maker m) {return m != nullptr;}));
+            for(Component c = 0; c < MAX_COMPONENTS; ++c)
+            {
+                if(makers[c] != nullptr)
+                {
+                    added[c].reserve(n);
+                    replaced[c].reserve(n);
+                }
+            }
+            working.reserve(n);
+            watched.reserve(n);
+        }
+        // Returns invalid_entity once capacity is reached
+        // The entity joins em.all_entities at the next flush whether or not
+        // anything is added to it.
+        Entity create()
+        {
+            ECS_PROFILE_COUNT(created);
+            Entity e = invalid_entity;
+            {
+                std::lock_guard<std::mutex> guard(ids);
+                e = em.get_entity();
+            }
+            if(e != invalid_entity)
+            {
+                local().created.push_back(e);
+            }
+            return e;
+        }
+        template<typename... Ts>
+        Entity create(const Ts&... components)
+        {
+            const Entity e = create();
+            if(e != invalid_entity)
+            {
+                const int expand[] = {0, (add<Ts>(e, components), 0)...};
+                (void)expand;
+            }
+            return e;
+        }
+        // Same as Manager::create_batch() but deferred
+        template<typename... Ts, typename F>
+        std::size_t create_batch(const Prefab<Ts...> &prefab, const std::size_t n, F init)
+        {
+            std::size_t i = 0;
+            for(; i < n; ++i)
+            {
+                const Entity e = create();
+                if(e == invalid_entity)
+                {
+                    break;
+                }
+
+                std::tuple<Ts...> components = prefab.components;
+                init(i, std::get<Ts>(components)...);
+
+                const int expand[] = {0, (add<Ts>(e, std::get<Ts>(components)), 0)...};
+                (void)expand;
+            }
+            return i;
+        }
+        template<typename T>
+        void add(const Entity e, const T &t)
+        {
+            assert(e != invalid_entity);
+            ECS_PROFILE_COUNT(added);
+
+            auto &queue = local().queues[T::id];
+            if(queue == nullptr)
+            {
+                queue.reset(make_queue<T>());
+            }
+            static_cast<AddQueue<Backend, T>&>(*queue).items.emplace_back(e, t);
+        }
+        // Applied after the adds in the same flush
+        template<typename T>
+        void remove(const Entity e)
+        {
+            assert(e != invalid_entity);
+            ECS_PROFILE_COUNT(removed);
+            local().removed[T::id].push_back(e);
+        }
+        // Destroying an entity twice, or one that's already dead, is fine
+        void destroy(const Entity e)
+        {
+            assert(e != invalid_entity);
+            ECS_PROFILE_COUNT(destroyed);
+            local().destroyed.push_back(e);
+        }
+        bool empty() const
+        {
+            for(auto &r : recordings)
+            {
+                if(r->empty() == false)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        // Call from one thread once nothing else is recording
+        void flush(Backend &cm, SystemManager &sm, const Observers &observers)
+        {
+            // Everything created since the last flush, with adds or not
+            // Any destroyed in this flush come out again further down.
+            for(auto &r : recordings)
+            {
+                for(auto e : r->created)
+                {
+                    if(em.alive(e) == true)
+                    {
+                        em.all_entities.insert(e);
+                    }
+                }
+                r->created.clear();
+            }
+
+            touched.clear();
+            for(Component c = 0; c < MAX_COMPONENTS; ++c)
+            {
+                for(auto &r : recordings)
+                {
+                    auto &queue = r->queues[c];
+                    if(queue != nullptr && queue->empty() == false)
+                    {
+                        queue->apply(cm, em, touched, added[c], replaced[c]);
+                    }
+                }
+            }
+
+            std::sort(touched.begin(), touched.end());
+            touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+            for(auto e : touched)
+            {
+                em.all_entities.insert(e);
+                sm.update_entity(e, cm.signature(e));
+            }
+
+            for(Component c = 0; c < MAX_COMPONENTS; ++c)
+            {
+                observers.notify_added(c, added[c]);
+                observers.notify_replaced(c, replaced[c]);
+                added[c].clear();
+                replaced[c].clear();
+            }
+
+            // Anything observers record lands in the emptied lists and waits
+            // for the next flush
+            for(Component c = 0; c < MAX_COMPONENTS; ++c)
+            {
+                working.clear();
+                for(auto &r : recordings)
+                {
+                    working.insert(working.end(), r->removed[c].begin(), r->removed[c].end());
+                    r->removed[c].clear();
+                }
+                if(working.empty() == true)
+                {
+                    continue;
+                }
+
+                std::sort(working.begin(), working.end());
+                working.erase(std::unique(working.begin(), working.end()), working.end());
+                working.erase(std::remove_if(working.begin(), working.end(), [this, &cm, c](const Entity e)
+                {
+                    return em.alive(e) == false || cm.entity_has_component(e, c) == false;
+                }), working.end());
+
+                observers.notify_removed(c, working);
+                for(auto e : working)
+                {
+                    cm.remove_entity_component(e, c);
+                    sm.component_removed(e, c);
+                }
+            }
+
+            working.clear();
+            for(auto &r : recordings)
+            {
+                working.insert(working.end(), r->destroyed.begin(), r->destroyed.end());
+                r->destroyed.clear();
+            }
+            destroy_now(cm, sm, observers, working);
+        }
+        // Bulk destroy used by flush(), es is sorted and filtered in place
+        // Duplicates and dead entities are dropped, then each store and
+        // system is only visited for the entities it actually holds.
+        void destroy_now(Backend &cm, SystemManager &sm, const Observers &observers, std::vector<Entity> &es)
+        {
+            std::sort(es.begin(), es.end());
+            es.erase(std::unique(es.begin(), es.end()), es.end());
+            es.erase(std::remove_if(es.begin(), es.end(), [this](const Entity e) {return em.alive(e) == false;}), es.end());
+
+            for(Component c = 0; c < MAX_COMPONENTS; ++c)
+            {
+                if(observers.watching_remove(c) == false)
+                {
+                    continue;
+                }
+
+                watched.clear();
+                for(auto e : es)
+                {
+                    if(cm.entity_has_component(e, c) == true)
+                    {
+                        watched.push_back(e);
+                    }
+                }
+                observers.notify_removed(c, watched);
+            }
+
+            for(auto e : es)
+            {
+                sm.remove_entity(e, cm.signature(e));
+            }
+            cm.remove_entities(es);
+            for(auto e : es)
+            {
+                em.remove_entity(e);
+            }
+        }
+    private:
+        // Everything one thread has recorded
+        struct Recording
+        {
+            Recording() : queues(), removed(), created({}), destroyed({})
+            {
+            }
+            bool empty() const
+            {
+                if(created.empty() == false || destroyed.empty() == false)
+                {
+                    return false;
+                }
+                for(auto &r : removed)
+                {
+                    if(r.empty() == false)
+                    {
+                        return false;
+                    }
+                }
+                for(auto &queue : queues)
+                {
+                    if(queue != nullptr && queue->empty() == false)
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            std::array<std::unique_ptr<CommandQueue<Backend>>, MAX_COMPONENTS> queues;
+            std::array<std::vector<Entity>, MAX_COMPONENTS> removed;
+            std::vector<Entity> created;
+            std::vector<Entity> destroyed;
+        };
+        typedef CommandQueue<Backend>* (*Maker)();
+        template<typename T>
+        static CommandQueue<Backend>* make_queue()
+        {
+            return new AddQueue<Backend, T>();
+        }
+        // The queues of every added component, sized by the last reserve()
+        void setup(Recording &r)
+        {
+            for(Component c = 0; c < MAX_COMPONENTS; ++c)
+            {
+                if(makers[c] == nullptr)
+                {
+                    continue;
+                }
+                if(r.queues[c] == nullptr)
+                {
+                    r.queues[c].reset(makers[c]());
+                }
+                r.queues[c]->reserve(reserved);
+                r.removed[c].reserve(reserved);
+            }
+            r.created.reserve(reserved);
+            r.destroyed.reserve(reserved);
+        }
+        Recording& local()
+        {
+            return *recordings[pool == nullptr ? 0 : pool->current_worker()];
+        }
+        EntityManager &em;
+        ThreadPool *pool;
+        std::vector<std::unique_ptr<Recording>> recordings;
+        std::array<Maker, MAX_COMPONENTS> makers;
+        // Changes of each kind per frame that new buffers get room for
+        std::size_t reserved;
+        std::mutex ids;
+        std::vector<Entity> touched;
+        std::array<std::vector<Entity>, MAX_COMPONENTS> added;
+        std::array<std::vector<Entity>, MAX_COMPONENTS> replaced;
+        std::vector<Entity> working;
+        std::vector<Entity> watched;
+};
+
+#endif
@@ -1,110 +1,755 @@
 #ifndef COMPONENT_MANAGER_HPP
 #define COMPONENT_MANAGER_HPP
 
+#include <algorithm>
+#include <array>
+#include <cassert>
 #include <iostream>
-#include <set>
-#include <unordered_map>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <memory>
+#include <vector>
+#include "component_type.hpp"
+#include "entity.hpp"
+#include "soa_store.hpp"
+#include "sparse_set.hpp"
+#include "thread_pool.hpp"
+#include "view.hpp"
 
-typedef uint32_t Entity;
-typedef uint32_t Component;
 
+// Every dense slot also carries the tick its component was last written on,
+// and each block of version_block slots the newest tick in it. Queries for
+// changed components skip whole blocks that are older than they care about.
 class Store
 {
     public:
+        static const std::size_t version_block = 64;
+
+        Store() : entities({}), tick(1), index(), versions({}), blocks({})
+        {
+        }
         virtual ~Store() = default;
         virtual void remove_entity(const Entity e) = 0;
+        // Exchange two dense slots, components and all
+        virtual void swap_slots(const uint32_t a, const uint32_t b) = 0;
+        virtual void reserve(const std::size_t n) = 0;
+        // Removes many entities at once. A few are swapped out one at a time,
+        // a large share of the store is compacted in a single pass instead,
+        // which also keeps the survivors in order.
+        void remove_entities(const std::vector<Entity> &es)
+        {
+            if(4 * es.size() < size())
+            {
+                for(auto e : es)
+                {
+                    remove_entity(e);
+                }
+                return;
+            }
+
+            for(auto e : es)
+            {
+                const uint32_t s = slot(e);
+                if(s != SparseIndex::npos)
+                {
+                    index.erase(entity_index(e));
+                    entities[s] = invalid_entity;
+                }
+            }
+
+            std::size_t kept = 0;
+            for(std::size_t i = 0; i < entities.size(); ++i)
+            {
+                if(entities[i] == invalid_entity)
+                {
+                    continue;
+                }
+                if(kept != i)
+                {
+                    entities[kept] = entities[i];
+                    move_slot(kept, i);
+                    index.set(entity_index(entities[kept]), kept);
+                    set_version(kept, versions[i]);
+                }
+                ++kept;
+            }
+            entities.resize(kept);
+            versions.resize(kept);
+            blocks.resize((kept + version_block - 1) / version_block);
+            truncate(kept);
+        }
+        // Room for n more entities, grows geometrically so a run of small
+        // batches doesn't reallocate every time
+        void reserve_more(const std::size_t n)
+        {
+            const std::size_t needed = entities.size() + n;
+            if(needed > entities.capacity())
+            {
+                reserve(std::max(needed, 2 * entities.capacity()));
+            }
+        }
+        // Allocates the sparse pages for entity indices below n
+        void reserve_index(const std::size_t n)
+        {
+            index.reserve(n);
+        }
+        // Stamps slots [begin, end) with the current tick, for code that
+        // writes the component arrays directly
+        void mark(const std::size_t begin, const std::size_t end)
+        {
+            for(std::size_t i = begin; i < end; ++i)
+            {
+                versions[i] = tick;
+            }
+            for(std::size_t b = begin / version_block; b * version_block < end; ++b)
+            {
+                blocks[b] = tick;
+            }
+        }
+        // The block is only written if it's behind, so once parallel_each()
+        // has raised every block threads marking slots in one don't race
+        void mark(const std::size_t i)
+        {
+            versions[i] = tick;
+            Tick &block = blocks[i / version_block];
+            if(block != tick)
+            {
+                block = tick;
+            }
+        }
+        // Stamps every block but no slots, only block_changed() is affected
+        void raise_blocks()
+        {
+            std::fill(blocks.begin(), blocks.end(), tick);
+        }
+        bool changed(const std::size_t i, const Tick since) const
+        {
+            return tick_newer(versions[i], since);
+        }
+        bool block_changed(const std::size_t b, const Tick since) const
+        {
+            return tick_newer(blocks[b], since);
+        }
+        // Written by the ComponentManager before each system runs
+        void set_tick(const Tick t)
+        {
+            tick = t;
+        }
+        bool has(const Entity e) const
+        {
+            return slot(e) != SparseIndex::npos;
+        }
+        std::size_t size() const
+        {
+            return entities.size();
+        }
+        // The sparse index is keyed by entity index, the stored handle is
+        // compared too so a stale generation doesn't alias a recycled entity
+        uint32_t slot(const Entity e) const
+        {
+            const uint32_t s = index.get(entity_index(e));
+            if(s == SparseIndex::npos || entities[s] != e)
+            {
+                return SparseIndex::npos;
+            }
+            return s;
+        }
+        std::vector<Entity> entities;
+    protected:
+        // Used by remove_entities(), entities and index are already handled
+        virtual void move_slot(const std::size_t to, const std::size_t from) = 0;
+        virtual void truncate(const std::size_t n) = 0;
+        // Bookkeeping shared by the stores, the components themselves are
+        // moved by the derived class alongside these
+        void push_slot(const Entity e)
+        {
+            index.set(entity_index(e), entities.size());
+            entities.push_back(e);
+            versions.push_back(tick);
+            if(blocks.size() * version_block < versions.size())
+            {
+                blocks.push_back(tick);
+            }
+            blocks.back() = tick;
+        }
+        void fill_slot(const uint32_t s, const uint32_t last)
+        {
+            entities[s] = entities[last];
+            index.set(entity_index(entities[s]), s);
+            set_version(s, versions[last]);
+        }
+        void pop_slot(const Entity e)
+        {
+            entities.pop_back();
+            versions.pop_back();
+            if((blocks.size() - 1) * version_block >= versions.size())
+            {
+                blocks.pop_back();
+            }
+            index.erase(entity_index(e));
+        }
+        void swap_entities(const uint32_t a, const uint32_t b)
+        {
+            std::swap(entities[a], entities[b]);
+            index.set(entity_index(entities[a]), a);
+            index.set(entity_index(entities[b]), b);
+
+            const Tick va = versions[a];
+            set_version(a, versions[b]);
+            set_version(b, va);
+        }
+        void reserve_slots(const std::size_t n)
+        {
+            entities.reserve(n);
+            versions.reserve(n);
+            blocks.reserve((n + version_block - 1) / version_block);
+        }
+        Tick tick;
+        SparseIndex index;
+    private:
+        // A block keeps its newest tick, moving an older one in leaves it
+        void set_version(const std::size_t i, const Tick t)
+        {
+            versions[i] = t;
+            Tick &block = blocks[i / version_block];
+            if(tick_newer(t, block) == true)
+            {
+                block = t;
+            }
+        }
+        std::vector<Tick> versions;
+        std::vector<Tick> blocks;
 };
 
+// Sparse set storage
+// Components are kept packed in a dense array with a parallel array of their
+// owners, so iterating a store is a linear scan. The sparse index maps an
+// entity back to its slot. Removal swaps the last element into the hole.
 template<typename T>
 class ComponentStore : public Store
 {
     public:
-        ComponentStore(const Component id_) : Store(), id(id_)
+        ComponentStore(const Component id_) : Store(), id(id_), components({})
         {
         }
+        // Overwrites the component if the entity already has one
         void add_entity(const Entity e, T t)
         {
-            components.insert(std::pair<Entity, T>(e, t));
+            const uint32_t s = slot(e);
+            if(s != SparseIndex::npos)
+            {
+                components[s] = t;
+                mark(s);
+                return;
+            }
+            push_slot(e);
+            components.push_back(t);
         }
         void remove_entity(const Entity e)
         {
-            components.erase(e);
+            const uint32_t s = slot(e);
+            if(s == SparseIndex::npos)
+            {
+                return;
+            }
+
+            const uint32_t last = entities.size() - 1;
+            if(s != last)
+            {
+                fill_slot(s, last);
+                components[s] = components[last];
+            }
+            pop_slot(e);
+            components.pop_back();
+        }
+        void swap_slots(const uint32_t a, const uint32_t b)
+        {
+            swap_entities(a, b);
+            std::swap(components[a], components[b]);
+        }
+        void move_slot(const std::size_t to, const std::size_t from)
+        {
+            components[to] = std::move(components[from]);
+        }
+        void truncate(const std::size_t n)
+        {
+            components.erase(components.begin() + n, components.end());
         }
+        // Marks the component as changed, use read_component() to only look
         T* get_component(const Entity e)
         {
-            return &components[e];
+            const uint32_t s = slot(e);
+            if(s == SparseIndex::npos)
+            {
+                return nullptr;
+            }
+            mark(s);
+            return &components[s];
+        }
+        // Skips the lookup while iterating this store's own dense array
+        T* get_component(const Entity e, const Store *driver, const std::size_t i)
+        {
+            if(driver == this)
+            {
+                mark(i);
+                return &components[i];
+            }
+            return get_component(e);
+        }
+        const T* read_component(const Entity e) const
+        {
+            const uint32_t s = slot(e);
+            if(s == SparseIndex::npos)
+            {
+                return nullptr;
+            }
+            return &components[s];
+        }
+        const T* read_component(const Entity e, const Store *driver, const std::size_t i) const
+        {
+            return driver == this ? &components[i] : read_component(e);
+        }
+        void reserve(const std::size_t n)
+        {
+            reserve_slots(n);
+            components.reserve(n);
         }
         void print()
         {
             std::cout << "ComponentStore:" << std::endl;
-            for(auto i : components)
+            for(std::size_t i = 0; i < entities.size(); ++i)
             {
-                std::cout << i.first << ": " << i.second.x << "," << i.second.y << std::endl;
+                std::cout << entities[i] << ": " << components[i].x << "," << components[i].y << std::endl;
             }
         }
         const Component id;
-        std::unordered_map<Entity, T> components;
+        std::vector<T> components;
     private:
 };
 
+// Sparse set storage with one aligned array per field
+// Used instead of ComponentStore<T> for components that opt in with
+// ECS_SOA2/ECS_SOA3. Lookups return a SoAPtr<T> rather than a T*.
+template<typename T>
+class SoAStore : public Store
+{
+    public:
+        typedef typename SoALayout<T>::Columns Columns;
+
+        SoAStore(const Component id_) : Store(), id(id_), columns()
+        {
+        }
+        void add_entity(const Entity e, T t)
+        {
+            const uint32_t s = slot(e);
+            if(s != SparseIndex::npos)
+            {
+                columns.at(s) = t;
+                mark(s);
+                return;
+            }
+            push_slot(e);
+            columns.push_back(t);
+        }
+        void remove_entity(const Entity e)
+        {
+            const uint32_t s = slot(e);
+            if(s == SparseIndex::npos)
+            {
+                return;
+            }
+
+            const uint32_t last = entities.size() - 1;
+            if(s != last)
+            {
+                fill_slot(s, last);
+                columns.move(s, last);
+            }
+            pop_slot(e);
+            columns.pop_back();
+        }
+        void swap_slots(const uint32_t a, const uint32_t b)
+        {
+            swap_entities(a, b);
+            columns.swap(a, b);
+        }
+        void move_slot(const std::size_t to, const std::size_t from)
+        {
+            columns.move(to, from);
+        }
+        void truncate(const std::size_t n)
+        {
+            while(columns.size() > n)
+            {
+                columns.pop_back();
+            }
+        }
+        SoAPtr<T> get_component(const Entity e)
+        {
+            const uint32_t s = slot(e);
+            if(s == SparseIndex::npos)
+            {
+                return nullptr;
+            }
+            mark(s);
+            return SoAPtr<T>(&columns, s);
+        }
+        SoAPtr<T> get_component(const Entity e, const Store *driver, const std::size_t i)
+        {
+            if(driver == this)
+            {
+                mark(i);
+                return SoAPtr<T>(&columns, i);
+            }
+            return get_component(e);
+        }
+        SoAPtr<const T> read_component(const Entity e) const
+        {
+            const uint32_t s = slot(e);
+            if(s == SparseIndex::npos)
+            {
+                return nullptr;
+            }
+            return SoAPtr<const T>(&columns, s);
+        }
+        SoAPtr<const T> read_component(const Entity e, const Store *driver, const std::size_t i) const
+        {
+            return driver == this ? SoAPtr<const T>(&columns, i) : read_component(e);
+        }
+        void reserve(const std::size_t n)
+        {
+            reserve_slots(n);
+            columns.reserve(n);
+        }
+        const Component id;
+        Columns columns;
+    private:
+};
+
+// The store used for T, picked by its layout
+template<typename T>
+using StoreFor = typename std::conditional<SoALayout<T>::enabled, SoAStore<T>, ComponentStore<T>>::type;
+
 class ComponentManager
 {
     public:
-        ComponentManager()
+        ComponentManager() : tick(1)
         {
         }
         void print()
         {
             std::cout << "ComponentManager:" << std::endl;
 
-            std::cout << "  Components:" << std::endl;
-            for(auto c : components)
+            std::cout << "  Stores:" << std::endl;
+            for(Component c = 0; c < MAX_COMPONENTS; ++c)
             {
-                std::cout << "    " << c.first << ":";
-                for(auto e : c.second)
+                if(stores[c] == nullptr)
                 {
-                    std::cout << " " << e;
+                    continue;
                 }
-                std::cout << std::endl;
-            }
 
-            std::cout << "  Stores:" << std::endl;
-            for(auto &s : stores)
-            {
-                std::cout << "    " << s.first << ":";
+                std::cout << "    " << c << ":";
+                for(auto e : stores[c]->entities)
+                {
+                    std::cout << " " << e;
+                }
                 std::cout << std::endl;
             }
         }
         template<typename T>
         void add_component()
         {
-            stores[T::id].reset(static_cast<Store*>(new ComponentStore<T>(T::id)));
+            stores[T::id].reset(static_cast<Store*>(new StoreFor<T>(T::id)));
+            stores[T::id]->set_tick(tick);
+        }
+        // Writes from now on are stamped with t
+        void set_tick(const Tick t)
+        {
+            tick = t;
+            for(auto &store : stores)
+            {
+                if(store != nullptr)
+                {
+                    store->set_tick(t);
+                }
+            }
         }
+        // Only visits the stores in the entity's signature
         void remove_entity(const Entity e)
         {
-            for(auto &component : components)
+            const uint32_t index = entity_index(e);
+            if(index >= signatures.size())
             {
-                component.second.erase(e);
+                return;
             }
-            for(auto &store : stores)
+
+            each_component(signatures[index], [this, e](Component c)
+            {
+                stores[c]->remove_entity(e);
+            });
+            signatures[index].reset();
+        }
+        // Groups the entities by store first so each store is only visited
+        // once, see Store::remove_entities()
+        void remove_entities(const std::vector<Entity> &es)
+        {
+            for(auto e : es)
+            {
+                const uint32_t index = entity_index(e);
+                if(index >= signatures.size())
+                {
+                    continue;
+                }
+
+                each_component(signatures[index], [this, e](Component c)
+                {
+                    doomed[c].push_back(e);
+                });
+                signatures[index].reset();
+            }
+
+            for(Component c = 0; c < MAX_COMPONENTS; ++c)
             {
-                store.second->remove_entity(e);
+                if(doomed[c].empty() == false)
+                {
+                    stores[c]->remove_entities(doomed[c]);
+                    doomed[c].clear();
+                }
             }
         }
         template<typename T>
-        ComponentStore<T>& get_store()
+        StoreFor<T>& get_store()
+        {
+            return static_cast<StoreFor<T>&>(*stores[T::id]);
+        }
+        template<typename T>
+        void add_entity_component(const Entity e, T t)
+        {
+            get_store<T>().add_entity(e, t);
+
+            const uint32_t index = entity_index(e);
+            if(index >= signatures.size())
+            {
+                signatures.resize(index + 1);
+            }
+            signatures[index].set(T::id);
+        }
+        // Room for n more entities in each of Ts
+        template<typename... Ts>
+        void reserve_more(const std::size_t n)
+        {
+            const int expand[] = {0, (get_store<Ts>().reserve_more(n), 0)...};
+            (void)expand;
+        }
+        // Room for n entities in every store, including the sparse pages for
+        // entity indices up to n, and for destroying all of them at once
+        void reserve(const std::size_t n)
+        {
+            signatures.reserve(n + 1);
+            for(Component c = 0; c < MAX_COMPONENTS; ++c)
+            {
+                if(stores[c] != nullptr)
+                {
+                    stores[c]->reserve(n);
+                    stores[c]->reserve_index(n + 1);
+                    doomed[c].reserve(n);
+                }
+            }
+        }
+        // Stores don't depend on which components an entity has together
+        template<typename... Ts>
+        void prepare()
+        {
+        }
+        // Adds every component at once and sets the signature bits together
+        template<typename... Ts>
+        void add_entity_components(const Entity e, const std::tuple<Ts...> &components)
+        {
+            const int expand[] = {0, (get_store<Ts>().add_entity(e, std::get<Ts>(components)), 0)...};
+            (void)expand;
+
+            const uint32_t index = entity_index(e);
+            if(index >= signatures.size())
+            {
+                signatures.resize(index + 1);
+            }
+            signatures[index] |= components_signature<Ts...>();
+        }
+        void remove_entity_component(const Entity e, const Component c)
+        {
+            const uint32_t index = entity_index(e);
+            if(index >= signatures.size() || signatures[index].test(c) == false)
+            {
+                return;
+            }
+            stores[c]->remove_entity(e);
+            signatures[index].reset(c);
+        }
+        const Signature& signature(const Entity e) const
+        {
+            static const Signature none;
+            const uint32_t index = entity_index(e);
+            return index < signatures.size() ? signatures[index] : none;
+        }
+        bool entity_has_component(const Entity e, const Component c) const
+        {
+            const uint32_t index = entity_index(e);
+            return index < signatures.size() && signatures[index].test(c);
+        }
+        // Calls f(e, Ts&...) for every entity with all of Ts and none of exclude
+        // Iteration is driven by the smallest required store, last entity first
+        // When only changed components are wanted it's driven by the smallest
+        // of those instead, and blocks of slots that haven't changed since
+        // are skipped without looking at their entities.
+        template<typename... Ts, typename F>
+        void each(const Signature &exclude, const Signature &changes, const Tick since, F f)
+        {
+            const Signature include = view_signature<Ts...>() | changes;
+            Store *driver = smallest(changes.any() ? changes : include);
+            std::tuple<StoreFor<typename ViewArg<Ts>::component>*...> typed(&get_store<typename ViewArg<Ts>::component>()...);
+            each_slot<Ts...>(typed, driver, 0, driver->size(), include, exclude, changes, since, f);
+        }
+        // Same as each() but the driving store's slots are split into ranges
+        // of about grain that run on the pool, f has to be safe to call from
+        // several threads at once. Ranges are whole blocks, and the blocks of
+        // every store handed out for writing are raised up front, so threads
+        // only ever mark their own slots.
+        template<typename... Ts, typename F>
+        void parallel_each(ThreadPool &pool, const std::size_t grain, const Signature &exclude, const Signature &changes, const Tick since, F f)
+        {
+            const Signature include = view_signature<Ts...>() | changes;
+            Store *driver = smallest(changes.any() ? changes : include);
+            std::tuple<StoreFor<typename ViewArg<Ts>::component>*...> typed(&get_store<typename ViewArg<Ts>::component>()...);
+
+            if(driver->size() <= grain || pool.size() < 2)
+            {
+                each_slot<Ts...>(typed, driver, 0, driver->size(), include, exclude, changes, since, f);
+                return;
+            }
+
+            const int raised[] = {0, (ViewArg<Ts>::writes ? (std::get<StoreFor<typename ViewArg<Ts>::component>*>(typed)->raise_blocks(), 0) : 0)...};
+            (void)raised;
+
+            pool.parallel_for(driver->size(), grain, [&](const std::size_t begin, const std::size_t end)
+            {
+                each_slot<Ts...>(typed, driver, begin, end, include, exclude, changes, since, f);
+            }, Store::version_block);
+        }
+        template<typename... Ts, typename F>
+        void each(const Signature &exclude, F f)
+        {
+            each<Ts...>(exclude, Signature(), 0, f);
+        }
+        template<typename... Ts, typename F>
+        void each(F f)
+        {
+            each<Ts...>(Signature(), f);
+        }
+        // Whether every component in changes was written to after since
+        bool changed_since(const Entity e, const Signature &changes, const Tick since) const
         {
-            return dynamic_cast<ComponentStore<T>&>(*stores[T::id]);
+            bool changed = true;
+            each_component(changes, [&](Component c)
+            {
+                const Store &store = *stores[c];
+                changed = changed && store.changed(store.slot(e), since);
+            });
+            return changed;
         }
-        bool entity_has_component(const Entity e, const Component c)
+        // Reorders the stores of A and B so the entities that have both come
+        // first, in the same order, and returns how many there are. Slot i of
+        // one dense array then belongs to the same entity as slot i of the
+        // other, so they can be walked side by side. Already packed stores
+        // only cost a linear compare.
+        // Don't call this from inside a view, it moves components around.
+        template<typename A, typename B>
+        std::size_t pack()
         {
-            return components[c].find(e) != components[c].end();
+            Store &a = get_store<A>();
+            Store &b = get_store<B>();
+
+            std::size_t n = 0;
+            for(std::size_t i = 0; i < a.size(); ++i)
+            {
+                const Entity e = a.entities[i];
+                if(i == n && n < b.size() && b.entities[n] == e)
+                {
+                    ++n;
+                    continue;
+                }
+
+                const uint32_t j = b.slot(e);
+                if(j == SparseIndex::npos)
+                {
+                    continue;
+                }
+                if(i != n)
+                {
+                    a.swap_slots(i, n);
+                }
+                if(j != n)
+                {
+                    b.swap_slots(j, n);
+                }
+                ++n;
+            }
+            return n;
         }
-        Component next = 0;
-        std::unordered_map<Component, std::set<Entity>> components;
-        std::unordered_map<Component, std::unique_ptr<Store>> stores;
+        // Indexed by ComponentType<T>::id
+        std::array<std::unique_ptr<Store>, MAX_COMPONENTS> stores;
     private:
+        // The smallest of the stores in s, which drives iteration
+        Store* smallest(const Signature &s) const
+        {
+            assert(s.any());
+
+            Store *best = nullptr;
+            each_component(s, [&](Component c)
+            {
+                if(best == nullptr || stores[c]->size() < best->size())
+                {
+                    best = stores[c].get();
+                }
+            });
+            return best;
+        }
+        // Visits the driver's slots in [begin, end), last first
+        // Blocks of slots that haven't changed since are skipped without
+        // looking at their entities.
+        template<typename... Ts, typename Typed, typename F>
+        void each_slot(Typed &typed, Store *driver, const std::size_t begin, const std::size_t end, const Signature &include, const Signature &exclude, const Signature &changes, const Tick since, F &f)
+        {
+            for(std::size_t i = end; i-- > begin;)
+            {
+                if(i >= driver->size())
+                {
+                    continue;
+                }
+                if(changes.any() && driver->block_changed(i / Store::version_block, since) == false)
+                {
+                    i = std::max(begin, i - i % Store::version_block);
+                    continue;
+                }
+
+                const Entity e = driver->entities[i];
+                const Signature &s = signatures[entity_index(e)];
+                if((s & include) != include || (s & exclude).any())
+                {
+                    continue;
+                }
+                if(changes.any() && changed_since(e, changes, since) == false)
+                {
+                    continue;
+                }
+
+                f(e, ViewArg<Ts>::get(StoreAccess<ViewArg<Ts>::writes>::get(std::get<StoreFor<typename ViewArg<Ts>::component>*>(typed), e, driver, i))...);
+            }
+        }
+        Tick tick;
+        std::vector<Signature> signatures;
+        // Scratch for remove_entities(), per store
+        std::array<std::vector<Entity>, MAX_COMPONENTS> doomed;
 };
 
 #endif
@@ -0,0 +1,33 @@
+#ifndef COMPONENT_TYPE_HPP
+#define COMPONENT_TYPE_HPP
+
+#include <cassert>
+#include "entity.hpp"
+
+class ComponentRegistry
+{
+    public:
+        static Component next()
+        {
+            static Component count = 0;
+            assert(count < MAX_COMPONENTS);
+            return count++;
+        }
+};
+
+// Components derive from ComponentType<T> to be given a dense id
+// Ids are handed out during static initialisation, so they're fixed before
+// main runs and reading T::id is a plain load
+//
+// class Transform : public ComponentType<Transform>
+template<typename T>
+class ComponentType
+{
+    public:
+        static const Component id;
+};
+
+template<typename T>
+const Component ComponentType<T>::id = ComponentRegistry::next();
+
+#endif
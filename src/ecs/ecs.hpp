@@ -2,15 +2,33 @@
 #define ECS_HPP
 
 #include "entity_manager.hpp"
+#include "command_buffer.hpp"
+#include "event_bus.hpp"
+#include "observer.hpp"
 #include "component_manager.hpp"
+#include "prefab.hpp"
+#include "profiler.hpp"
 #include "system_manager.hpp"
+#include "thread_pool.hpp"
+
+// Build with -DECS_ARCHETYPES to store components in archetype chunks
+// instead of one sparse set per component
+#ifdef ECS_ARCHETYPES
+#include "archetype_manager.hpp"
+typedef ArchetypeComponentManager ComponentBackend;
+#else
+typedef ComponentManager ComponentBackend;
+#endif
 
 class Manager
 {
     public:
-        Manager() : em(EntityManager()), cm(ComponentManager()), sm(SystemManager()), remove({})
+        Manager() : em(EntityManager()), cm(ComponentBackend()), sm(SystemManager()), commands(em), events(), observers(), pool(nullptr), tick(1), frames(0), batch({}), doomed({}), single({})
         {
         }
+        // The command buffer holds on to em
+        Manager(const Manager&) = delete;
+        Manager& operator=(const Manager&) = delete;
         void print()
         {
             em.print();
@@ -20,50 +38,225 @@ class Manager
             sm.print();
             std::cout << std::endl;
         }
+        // Replaces the value if the entity already has a T
         template<typename T>
         void add_entity_component(Entity e, T t)
         {
-            assert(e != invalid_entity);
+            assert(em.alive(e));
 
+            const bool replacing = cm.entity_has_component(e, T::id);
             em.all_entities.insert(e);
-            em.entities[e].insert(T::id);
-            cm.components[T::id].insert(e);
-            cm.get_store<T>().add_entity(e, t);
-            sm.update_entity(e, em.entities[e]);
+            cm.add_entity_component<T>(e, t);
+
+            single.assign(1, e);
+            if(replacing == true)
+            {
+                observers.notify_replaced(T::id, single);
+            }
+            else
+            {
+                sm.component_added(e, T::id, cm.signature(e));
+                observers.notify_added(T::id, single);
+            }
+        }
+        // Systems that require T drop the entity, no others are checked
+        template<typename T>
+        void remove_entity_component(const Entity e)
+        {
+            assert(em.alive(e));
+
+            if(cm.entity_has_component(e, T::id) == false)
+            {
+                return;
+            }
+            single.assign(1, e);
+            observers.notify_removed(T::id, single);
+            cm.remove_entity_component(e, T::id);
+            sm.component_removed(e, T::id);
+        }
+        // Creates up to n entities, each with every component in the prefab
+        // init(i, Ts&...) sets up the i'th entity's components, which start
+        // as copies of the prefab's. IDs are handed out as a block, storage
+        // is reserved once and systems are matched once for the whole batch.
+        // Returns how many were made, fewer than n if capacity runs out.
+        template<typename... Ts, typename F>
+        std::size_t create_batch(const Prefab<Ts...> &prefab, const std::size_t n, F init)
+        {
+            batch.clear();
+            em.get_entities(n, batch);
+            cm.template reserve_more<Ts...>(batch.size());
+
+            for(std::size_t i = 0; i < batch.size(); ++i)
+            {
+                std::tuple<Ts...> components = prefab.components;
+                init(i, std::get<Ts>(components)...);
+                cm.add_entity_components(batch[i], components);
+            }
+
+            em.all_entities.insert(batch.begin(), batch.end());
+            sm.add_entities(batch, components_signature<Ts...>());
+
+            const int expand[] = {0, (observers.notify_added(Ts::id, batch), 0)...};
+            (void)expand;
+            return batch.size();
+        }
+        // create_batch<Transform, Size>(n, init) starts from default constructed components
+        template<typename... Ts, typename F>
+        std::size_t create_batch(const std::size_t n, F init)
+        {
+            return create_batch(Prefab<Ts...>(), n, init);
         }
+        // One entity with all of these components
+        // Returns invalid_entity if capacity has been reached
+        template<typename... Ts>
+        Entity create(const Ts&... components)
+        {
+            if(create_batch(Prefab<Ts...>(components...), 1, [](std::size_t, Ts&...) {}) == 0)
+            {
+                return invalid_entity;
+            }
+            return batch[0];
+        }
+        // T* or, for structure of arrays components, a SoAPtr<T>
+        // Counts as a write for change tracking, use read_entity_component()
+        // when only looking
         template<typename T>
-        T* get_entity_component(const Entity e)
+        auto get_entity_component(const Entity e)
         {
             return cm.get_store<T>().get_component(e);
         }
+        // const T* or SoAPtr<const T>
+        template<typename T>
+        auto read_entity_component(const Entity e)
+        {
+            return cm.get_store<T>().read_component(e);
+        }
+        // manager.view<Transform, Velocity>().exclude<Player>().each(...)
+        template<typename... Ts>
+        View<ComponentBackend, Ts...> view()
+        {
+            return View<ComponentBackend, Ts...>(cm, pool.get());
+        }
         template<typename T>
         void create_component()
         {
             cm.add_component<T>();
+            commands.add_component<T>();
         }
         template<typename T>
         void create_system(T* t)
         {
             t->manager = this;
             sm.add_system<T>(t);
+            t->init();
+        }
+        // Runs systems that don't conflict at the same time, and
+        // view().parallel_each() across threads, on a pool of n threads
+        // including the caller. 1 goes back to running everything in order.
+        // Call it between updates.
+        void set_threads(const std::size_t n)
+        {
+            sm.set_pool(nullptr);
+            commands.set_pool(nullptr);
+            pool.reset(n > 1 ? new ThreadPool(n) : nullptr);
+            sm.set_pool(pool.get());
+            commands.set_pool(pool.get());
+        }
+        std::size_t threads() const
+        {
+            return pool == nullptr ? 1 : pool->size();
+        }
+        // Room for n entities at once in the entity tables, every store and
+        // every system, and for changes of each kind of structural change a
+        // frame in the command buffer, so nothing allocates as entities come
+        // and go. Systems size their own buffers in System::reserve(), after
+        // the stores so archetypes they prepare() get room too.
+        // Call it after the components and systems have been created.
+        void reserve(const std::size_t n, const std::size_t changes)
+        {
+            em.reserve(n);
+            cm.reserve(n);
+            sm.reserve(n);
+            commands.reserve(changes);
+        }
+        // Gets the storage ready for entities the command buffer makes with
+        // Ts, so the first one made mid-game doesn't allocate. Archetypes
+        // are made for each step of adding Ts in turn.
+        template<typename... Ts>
+        void prepare()
+        {
+            cm.template prepare<Ts...>();
+        }
+        template<typename... Ts>
+        void prepare(const Prefab<Ts...>&)
+        {
+            prepare<Ts...>();
+        }
+        // nullptr when running on one thread
+        ThreadPool* thread_pool()
+        {
+            return pool.get();
         }
+        // Systems record structural changes in commands, they're applied
+        // once every system has run. Events published this frame can be
+        // read next frame.
         void update(const float dt)
         {
-            sm.update(dt);
-
-            for(auto e : remove)
+            sm.update(dt, [this]() {return advance_tick();});
+            flush();
+            events.swap();
+            frames++;
+#ifdef ECS_PROFILE
+            Profiler::get().collect();
+#endif
+        }
+        // How many times update() has finished
+        std::size_t frame() const
+        {
+            return frames;
+        }
+        // Sync point, applies everything recorded in commands so far
+        void flush()
+        {
+            advance_tick();
+            commands.flush(cm, sm, observers);
+        }
+        // Components written from now on are stamped with the new tick
+        Tick advance_tick()
+        {
+            cm.set_tick(++tick);
+            return tick;
+        }
+        Tick current_tick() const
+        {
+            return tick;
+        }
+        // Destroys every entity the view visits, e.g. all particles with
+        // destroy_all(view<Fade>()). Happens straight away, so don't call
+        // it from inside a view; record commands.destroy() there instead.
+        template<typename... Ts>
+        void destroy_all(View<ComponentBackend, Ts...> query)
+        {
+            doomed.clear();
+            query.each([this](Entity e, auto&&...)
             {
-                em.remove_entity(e);
-                cm.remove_entity(e);
-                sm.remove_entity(e);
-            }
-            remove.clear();
+                doomed.push_back(e);
+            });
+            commands.destroy_now(cm, sm, observers, doomed);
         }
         EntityManager em;
-        ComponentManager cm;
+        ComponentBackend cm;
         SystemManager sm;
-        std::vector<Entity> remove;
+        CommandBuffer<ComponentBackend> commands;
+        EventBus events;
+        Observers observers;
     private:
+        std::unique_ptr<ThreadPool> pool;
+        Tick tick;
+        std::size_t frames;
+        std::vector<Entity> batch;
+        std::vector<Entity> doomed;
+        std::vector<Entity> single;
 };
 
 #endif
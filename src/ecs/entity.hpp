@@ -0,0 +1,57 @@
+#ifndef ENTITY_HPP
+#define ENTITY_HPP
+
+#include <bitset>
+#include <cstdint>
+
+#define MAX_COMPONENTS 64
+
+// An entity handle packs a 32 bit index into the entity tables with a 32 bit
+// generation. The generation is bumped whenever the index is freed, so a
+// stale handle to a recycled index no longer compares equal to the new one.
+typedef uint64_t Entity;
+typedef uint32_t Component;
+const Entity invalid_entity = 0;
+
+// One bit per component type
+typedef std::bitset<MAX_COMPONENTS> Signature;
+
+// Stores stamp components with the tick they were last written on
+// Ticks wrap, so compare them with tick_newer() rather than >
+typedef uint32_t Tick;
+
+inline bool tick_newer(const Tick version, const Tick since)
+{
+    return static_cast<int32_t>(version - since) > 0;
+}
+
+// Calls f(c) for each component set in s, lowest first
+template<typename F>
+void each_component(const Signature &s, F f)
+{
+    static_assert(MAX_COMPONENTS <= 64, "each_component() walks the signature as one 64 bit word");
+
+    unsigned long long bits = s.to_ullong();
+    while(bits != 0)
+    {
+        f(static_cast<Component>(__builtin_ctzll(bits)));
+        bits &= bits - 1;
+    }
+}
+
+inline uint32_t entity_index(const Entity e)
+{
+    return e & 0xFFFFFFFF;
+}
+
+inline uint32_t entity_generation(const Entity e)
+{
+    return e >> 32;
+}
+
+inline Entity make_entity(const uint32_t index, const uint32_t generation)
+{
+    return (Entity)generation << 32 | index;
+}
+
+#endif
@@ -3,58 +3,125 @@
 
 #include <cassert>
 #include <iostream>
-#include <set>
-#include <unordered_map>
-
-#define MAX_ENTITIES 1000000
-
-typedef uint32_t Entity;
-typedef uint32_t Component;
-const Entity invalid_entity = 0;
+#include <vector>
+#include "entity.hpp"
+#include "entity_set.hpp"
 
 class EntityManager
 {
     public:
-        EntityManager() : all_entities({}), entities({})
-        {
-        }
-        void add(std::set<Component> components)
+        static const std::size_t default_capacity = 1000000;
+
+        explicit EntityManager(const std::size_t capacity_ = default_capacity) : all_entities({}), capacity(capacity_), generations({}), free_indices({})
         {
-            entities[next] = components;
-            next++;
+            // Index 0 is never handed out so invalid_entity is never alive
+            generations.push_back(1);
         }
         void remove_entity(const Entity e)
         {
             assert(e != invalid_entity);
 
+            if(alive(e) == false)
+            {
+                return;
+            }
+
+            const uint32_t index = entity_index(e);
+            generations[index]++;
+            free_indices.push_back(index);
+
             all_entities.erase(e);
-            entities.erase(e);
         }
         void print()
         {
             std::cout << "EntityManager:" << std::endl;
-            for(auto e : entities)
+            for(auto e : all_entities)
             {
-                std::cout << "  " << e.first << ":";
-                for(auto c : e.second)
-                {
-                    std::cout << " " << c;
-                }
-                std::cout << std::endl;
+                std::cout << "  " << entity_index(e) << "v" << entity_generation(e) << std::endl;
             }
         }
+        // Recycles freed indices before growing the tables
+        // Returns invalid_entity once capacity entities are alive
         Entity get_entity()
         {
-            if(next >= MAX_ENTITIES)
+            if(count() >= capacity)
             {
                 return invalid_entity;
             }
-            return next++;
+
+            if(free_indices.empty() == false)
+            {
+                const uint32_t index = free_indices.back();
+                free_indices.pop_back();
+                return make_entity(index, generations[index]);
+            }
+
+            const uint32_t index = generations.size();
+            generations.push_back(0);
+            grow_free_list();
+            return make_entity(index, 0);
         }
-        Entity next = 1;
-        std::set<Entity> all_entities;
-        std::unordered_map<Entity, std::set<Component>> entities;
+        // Hands out up to n entities at once, freed indices first and then a
+        // fresh block. Appends them to out and returns how many there were.
+        std::size_t get_entities(std::size_t n, std::vector<Entity> &out)
+        {
+            if(count() + n > capacity)
+            {
+                n = count() < capacity ? capacity - count() : 0;
+            }
+            out.reserve(out.size() + n);
+
+            std::size_t recycled = 0;
+            for(; recycled < n && free_indices.empty() == false; ++recycled)
+            {
+                const uint32_t index = free_indices.back();
+                free_indices.pop_back();
+                out.push_back(make_entity(index, generations[index]));
+            }
+
+            const uint32_t first = generations.size();
+            generations.resize(first + n - recycled, 0);
+            grow_free_list();
+            for(uint32_t index = first; index < generations.size(); ++index)
+            {
+                out.push_back(make_entity(index, 0));
+            }
+            return n;
+        }
+        bool alive(const Entity e) const
+        {
+            const uint32_t index = entity_index(e);
+            return index < generations.size() && generations[index] == entity_generation(e);
+        }
+        // Number of live entities
+        std::size_t count() const
+        {
+            return generations.size() - 1 - free_indices.size();
+        }
+        void set_capacity(const std::size_t n)
+        {
+            capacity = n;
+        }
+        void reserve(const std::size_t n)
+        {
+            generations.reserve(n + 1);
+            free_indices.reserve(n);
+            all_entities.reserve(n + 1);
+        }
+        EntitySet all_entities;
+        std::size_t capacity;
     private:
+        // Room for every index to be freed at once, so remove_entity()
+        // doesn't allocate when lots of entities die together
+        void grow_free_list()
+        {
+            if(free_indices.capacity() < generations.capacity())
+            {
+                free_indices.reserve(generations.capacity());
+            }
+        }
+        std::vector<uint32_t> generations;
+        std::vector<uint32_t> free_indices;
 };
 
 #endif
@@ -0,0 +1,109 @@
+#ifndef ENTITY_SET_HPP
+#define ENTITY_SET_HPP
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "entity.hpp"
+
+// A set of entities as a sparse set, replacing std::set<Entity>
+// Insert, erase and lookup are O(1) and reuse two flat tables, so once
+// they've grown to the most entities and highest index seen, or been
+// reserved, nothing allocates. Iterates in no particular order, erase
+// moves the last entity into the gap.
+class EntitySet
+{
+    public:
+        typedef std::vector<Entity>::const_iterator const_iterator;
+
+        EntitySet() : dense({}), sparse({})
+        {
+        }
+        bool contains(const Entity e) const
+        {
+            const uint32_t i = entity_index(e);
+            return i < sparse.size() && sparse[i] < dense.size() && dense[sparse[i]] == e;
+        }
+        // Returns false if e was already in
+        // An older generation of the same index is replaced.
+        bool insert(const Entity e)
+        {
+            const uint32_t i = entity_index(e);
+            if(i >= sparse.size())
+            {
+                sparse.resize(i + 1, static_cast<uint32_t>(npos));
+            }
+
+            const uint32_t at = sparse[i];
+            if(at < dense.size() && entity_index(dense[at]) == i)
+            {
+                if(dense[at] == e)
+                {
+                    return false;
+                }
+                dense[at] = e;
+                return true;
+            }
+
+            sparse[i] = dense.size();
+            dense.push_back(e);
+            return true;
+        }
+        template<typename It>
+        void insert(It first, const It last)
+        {
+            for(; first != last; ++first)
+            {
+                insert(*first);
+            }
+        }
+        // Returns how many were removed, 0 or 1
+        std::size_t erase(const Entity e)
+        {
+            if(contains(e) == false)
+            {
+                return 0;
+            }
+
+            const uint32_t at = sparse[entity_index(e)];
+            const Entity moved = dense.back();
+            dense[at] = moved;
+            sparse[entity_index(moved)] = at;
+            dense.pop_back();
+            sparse[entity_index(e)] = npos;
+            return 1;
+        }
+        void clear()
+        {
+            dense.clear();
+        }
+        // Room for n entities with indices below n
+        void reserve(const std::size_t n)
+        {
+            dense.reserve(n);
+            sparse.reserve(n);
+        }
+        std::size_t size() const
+        {
+            return dense.size();
+        }
+        bool empty() const
+        {
+            return dense.empty();
+        }
+        const_iterator begin() const
+        {
+            return dense.begin();
+        }
+        const_iterator end() const
+        {
+            return dense.end();
+        }
+    private:
+        static const uint32_t npos = std::numeric_limits<uint32_t>::max();
+        std::vector<Entity> dense;
+        // Position in dense by entity index, npos or stale if not in
+        std::vector<uint32_t> sparse;
+};
+
+#endif
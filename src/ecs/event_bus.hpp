@@ -0,0 +1,165 @@
+#ifndef EVENT_BUS_HPP
+#define EVENT_BUS_HPP
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define MAX_EVENTS 32
+
+typedef uint32_t Event;
+
+class EventRegistry
+{
+    public:
+        static Event next()
+        {
+            static Event count = 0;
+            assert(count < MAX_EVENTS);
+            return count++;
+        }
+};
+
+// Events derive from EventType<E> to be given a dense id, same as components
+//
+// class CollisionEvent : public EventType<CollisionEvent>
+template<typename E>
+class EventType
+{
+    public:
+        static const Event id;
+};
+
+template<typename E>
+const Event EventType<E>::id = EventRegistry::next();
+
+class EventQueueBase
+{
+    public:
+        virtual ~EventQueueBase() = default;
+        virtual void swap() = 0;
+        virtual void clear() = 0;
+};
+
+// Double buffered queue for one event type
+// Events published this frame go into the back buffer and are read from
+// the front buffer after the next swap(), so readers see everything
+// published during the previous frame as one contiguous array. The buffers
+// are cleared rather than freed, so once they've grown to the busiest frame
+// publishing and reading don't allocate.
+template<typename E>
+class EventQueue : public EventQueueBase
+{
+    public:
+        EventQueue() : front({}), back({}), lock()
+        {
+        }
+        void publish(const E &e)
+        {
+            back.push_back(e);
+        }
+        // Safe to call from several threads at once, but not at the same
+        // time as publish() or swap()
+        void publish_shared(const E &e)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            back.push_back(e);
+        }
+        // Appends a thread's own batch under one lock
+        void publish_shared(const std::vector<E> &es)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            back.insert(back.end(), es.begin(), es.end());
+        }
+        const std::vector<E>& read() const
+        {
+            return front;
+        }
+        void swap()
+        {
+            front.clear();
+            front.swap(back);
+        }
+        void clear()
+        {
+            front.clear();
+            back.clear();
+        }
+        void reserve(const std::size_t n)
+        {
+            front.reserve(n);
+            back.reserve(n);
+        }
+    private:
+        std::vector<E> front;
+        std::vector<E> back;
+        std::mutex lock;
+};
+
+// One EventQueue per event type, created the first time it's used
+// manager.events.publish(CollisionEvent(a, b));
+// for(auto &event : manager.events.read<CollisionEvent>()) {...}
+class EventBus
+{
+    public:
+        EventBus() : queues()
+        {
+        }
+        EventBus(const EventBus&) = delete;
+        EventBus& operator=(const EventBus&) = delete;
+        template<typename E>
+        EventQueue<E>& queue()
+        {
+            auto &q = queues[E::id];
+            if(q == nullptr)
+            {
+                q.reset(new EventQueue<E>());
+            }
+            return static_cast<EventQueue<E>&>(*q);
+        }
+        template<typename E>
+        void publish(const E &e)
+        {
+            queue<E>().publish(e);
+        }
+        // The queue must already exist, call queue<E>() before going parallel
+        template<typename E>
+        void publish_shared(const E &e)
+        {
+            queue<E>().publish_shared(e);
+        }
+        // Everything published before the last swap()
+        template<typename E>
+        const std::vector<E>& read()
+        {
+            return queue<E>().read();
+        }
+        // Called once a frame by the Manager
+        void swap()
+        {
+            for(auto &q : queues)
+            {
+                if(q != nullptr)
+                {
+                    q->swap();
+                }
+            }
+        }
+        void clear()
+        {
+            for(auto &q : queues)
+            {
+                if(q != nullptr)
+                {
+                    q->clear();
+                }
+            }
+        }
+    private:
+        std::array<std::unique_ptr<EventQueueBase>, MAX_EVENTS> queues;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef OBSERVER_HPP
+#define OBSERVER_HPP
+
+#include <array>
+#include <functional>
+#include <vector>
+#include "entity.hpp"
+
+// Callbacks for components being added, removed or replaced
+// Each callback gets every entity affected by one structural change at
+// once, e.g. all the entities given T in a flush or a create_batch(). Added
+// and replaced fire once the component is in place, removed fires while it
+// can still be read, including when the entity is being destroyed.
+//
+// manager.observers.on_add<Trail>([](const std::vector<Entity> &es) {...});
+//
+// Callbacks run during a flush, so they should record structural changes
+// in manager.commands, which are applied at the next flush.
+class Observers
+{
+    public:
+        typedef std::function<void(const std::vector<Entity>&)> Callback;
+
+        Observers() : added(), removed(), replaced()
+        {
+        }
+        template<typename T>
+        void on_add(Callback f)
+        {
+            added[T::id].push_back(f);
+        }
+        template<typename T>
+        void on_remove(Callback f)
+        {
+            removed[T::id].push_back(f);
+        }
+        // T was added to an entity that already had one
+        template<typename T>
+        void on_replace(Callback f)
+        {
+            replaced[T::id].push_back(f);
+        }
+        bool watching_remove(const Component c) const
+        {
+            return removed[c].empty() == false;
+        }
+        void notify_added(const Component c, const std::vector<Entity> &es) const
+        {
+            notify(added[c], es);
+        }
+        void notify_removed(const Component c, const std::vector<Entity> &es) const
+        {
+            notify(removed[c], es);
+        }
+        void notify_replaced(const Component c, const std::vector<Entity> &es) const
+        {
+            notify(replaced[c], es);
+        }
+    private:
+        static void notify(const std::vector<Callback> &callbacks, const std::vector<Entity> &es)
+        {
+            if(es.empty() == true)
+            {
+                return;
+            }
+            for(auto &f : callbacks)
+            {
+                f(es);
+            }
+        }
+        std::array<std::vector<Callback>, MAX_COMPONENTS> added;
+        std::array<std::vector<Callback>, MAX_COMPONENTS> removed;
+        std::array<std::vector<Callback>, MAX_COMPONENTS> replaced;
+};
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+// Build with -DECS_PERF_COUNTERS to count cycles, instructions, cache
+// misses and branch misses in each system with perf_event_open(). Linux
+// only. Where the kernel won't hand out counters, e.g. perf_event_paranoid
+// is too high or there's no PMU in a VM, everything still runs and
+// PerfCounters::reason() says why there are no numbers.
+
+#ifdef ECS_PERF_COUNTERS
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum PerfEvent
+{
+    Cycles,
+    Instructions,
+    L1DMisses,
+    LLCMisses,
+    BranchMisses,
+    NumPerfEvents
+};
+
+inline const char* perf_event_name(const int event)
+{
+    static const char *names[NumPerfEvents] = {"cycles", "instructions", "L1D misses", "LLC misses", "branch misses"};
+    return names[event];
+}
+
+// What one system counted, from whichever threads its work ran on
+class PerfTotals
+{
+    public:
+        PerfTotals() : counts(), entities(0), updates(0)
+        {
+            for(auto &c : counts)
+            {
+                c.store(0, std::memory_order_relaxed);
+            }
+        }
+        std::array<std::atomic<uint64_t>, NumPerfEvents> counts;
+        // Summed over updates, for per entity figures
+        std::atomic<uint64_t> entities;
+        std::atomic<uint64_t> updates;
+};
+
+// The calling thread's counters, opened the first time it's asked for
+// Counts are charged to whatever target is current. Switching target
+// charges everything since the last switch to the old one first, so work
+// is counted once however scopes nest, e.g. a thread that runs another
+// system's task while it waits.
+class PerfCounters
+{
+    public:
+        static PerfCounters& local()
+        {
+            static thread_local PerfCounters counters;
+            return counters;
+        }
+        // Whether this thread got any counters, and why not if it didn't
+        bool available() const
+        {
+            return events > 0;
+        }
+        bool counting(const int event) const
+        {
+            return slot[event] >= 0;
+        }
+        const std::string& reason() const
+        {
+            return why;
+        }
+        PerfTotals* target() const
+        {
+            return current;
+        }
+        // Charges counts so far to the current target and moves on to t
+        void switch_to(PerfTotals *t)
+        {
+            charge();
+            current = t;
+        }
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+        ~PerfCounters()
+        {
+#ifdef __linux__
+            for(auto fd : fds)
+            {
+                if(fd >= 0)
+                {
+                    close(fd);
+                }
+            }
+#endif
+        }
+    private:
+        PerfCounters() : fds(), slot(), events(0), last(), current(nullptr), why()
+        {
+            fds.fill(-1);
+            slot.fill(-1);
+            last.fill(0);
+#ifdef __linux__
+            // One group so they're all read at once, without whichever
+            // events this machine can't count
+            int leader = -1;
+            for(int e = 0; e < NumPerfEvents; ++e)
+            {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP;
+                set_event(attr, e);
+
+                const int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+                if(fd < 0)
+                {
+                    if(why.empty() == true)
+                    {
+                        why = std::string(perf_event_name(e)) + ": " + std::strerror(errno);
+                    }
+                    continue;
+                }
+                if(leader < 0)
+                {
+                    leader = fd;
+                }
+                fds[e] = fd;
+                slot[e] = events++;
+            }
+            if(events > 0)
+            {
+                read_counts(last);
+            }
+#else
+            why = "hardware counters need Linux";
+#endif
+        }
+#ifdef __linux__
+        static void set_event(perf_event_attr &attr, const int event)
+        {
+            const uint64_t read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            switch(event)
+            {
+                case Cycles:
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                    break;
+                case Instructions:
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                    break;
+                case L1DMisses:
+                    attr.type = PERF_TYPE_HW_CACHE;
+                    attr.config = PERF_COUNT_HW_CACHE_L1D | read_miss;
+                    break;
+                case LLCMisses:
+                    attr.type = PERF_TYPE_HW_CACHE;
+                    attr.config = PERF_COUNT_HW_CACHE_LL | read_miss;
+                    break;
+                case BranchMisses:
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+                    break;
+                default:
+                    break;
+            }
+        }
+#endif
+        // Indexed by PerfEvent, events that aren't counted stay 0
+        bool read_counts(std::array<uint64_t, NumPerfEvents> &out) const
+        {
+#ifdef __linux__
+            // PERF_FORMAT_GROUP reads the number of events then each value
+            std::array<uint64_t, NumPerfEvents + 1> buffer;
+            const int leader = fds[first()];
+            if(read(leader, buffer.data(), sizeof(buffer)) < static_cast<ssize_t>(sizeof(uint64_t) * (events + 1)))
+            {
+                return false;
+            }
+            for(int e = 0; e < NumPerfEvents; ++e)
+            {
+                out[e] = slot[e] >= 0 ? buffer[1 + slot[e]] : 0;
+            }
+            return true;
+#else
+            (void)out;
+            return false;
+#endif
+        }
+        int first() const
+        {
+            for(int e = 0; e < NumPerfEvents; ++e)
+            {
+                if(slot[e] == 0)
+                {
+                    return e;
+                }
+            }
+            return 0;
+        }
+        void charge()
+        {
+            if(events == 0)
+            {
+                return;
+            }
+            std::array<uint64_t, NumPerfEvents> now;
+            if(read_counts(now) == false)
+            {
+                return;
+            }
+            if(current != nullptr)
+            {
+                for(int e = 0; e < NumPerfEvents; ++e)
+                {
+                    current->counts[e].fetch_add(now[e] - last[e], std::memory_order_relaxed);
+                }
+            }
+            last = now;
+        }
+        std::array<int, NumPerfEvents> fds;
+        // Position of each event in a group read, -1 if it isn't counted
+        std::array<int, NumPerfEvents> slot;
+        int events;
+        std::array<uint64_t, NumPerfEvents> last;
+        PerfTotals *current;
+        std::string why;
+};
+
+// Counts towards t until the end of the scope
+class PerfScope
+{
+    public:
+        explicit PerfScope(PerfTotals *t) : previous(PerfCounters::local().target())
+        {
+            PerfCounters::local().switch_to(t);
+        }
+        PerfScope(const PerfScope&) = delete;
+        PerfScope& operator=(const PerfScope&) = delete;
+        ~PerfScope()
+        {
+            PerfCounters::local().switch_to(previous);
+        }
+    private:
+        PerfTotals *previous;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef PREFAB_HPP
+#define PREFAB_HPP
+
+#include <tuple>
+
+// The components an entity is created with and the values they start from
+// Prefab<Transform, Size, Render> spark(Transform(), Size(1.0), Render(220, 20, 20));
+// manager.create_batch(spark, 20, [](std::size_t i, Transform &t, Size&, Render&) {...});
+template<typename... Ts>
+class Prefab
+{
+    public:
+        Prefab() : components()
+        {
+        }
+        explicit Prefab(const Ts&... ts) : components(ts...)
+        {
+        }
+        std::tuple<Ts...> components;
+    private:
+};
+
+#endif
@@ -0,0 +1,432 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+// Build with -DECS_PROFILE to time every system and any zones marked inside
+// them. Without it ECS_ZONE() expands to nothing and none of this is used.
+//
+// void update(const float dt)
+// {
+//     ECS_ZONE("broadphase");
+//     ...
+// }
+
+#define ECS_ZONE_CONCAT2(a, b) a##b
+#define ECS_ZONE_CONCAT(a, b) ECS_ZONE_CONCAT2(a, b)
+
+#ifdef ECS_PROFILE
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// name has to outlive the profiler, e.g. a string literal
+#define ECS_ZONE(name) ProfileZone ECS_ZONE_CONCAT(profile_zone_, __LINE__)(name)
+
+// Structural changes a system recorded in the command buffer
+// Counted from whichever thread the system's work runs on.
+class ProfileChanges
+{
+    public:
+        ProfileChanges() : created(0), destroyed(0), added(0), removed(0)
+        {
+        }
+        std::atomic<uint32_t> created;
+        std::atomic<uint32_t> destroyed;
+        std::atomic<uint32_t> added;
+        std::atomic<uint32_t> removed;
+};
+
+// One system update or zone
+// name is a system's name or a zone's literal, so the systems have to be
+// around for as long as their samples are.
+struct ProfileSample
+{
+    const char *name;
+    // Nanoseconds since the profiler started
+    uint64_t begin;
+    uint64_t end;
+    uint32_t frame;
+    uint32_t thread;
+    // The rest are only set for systems
+    bool system;
+    uint32_t entities;
+    uint32_t created;
+    uint32_t destroyed;
+    uint32_t added;
+    uint32_t removed;
+};
+
+// Samples from one thread waiting to be collected
+// Only the owning thread writes and only collect() reads, so head and tail
+// are all the synchronisation there is. A full ring drops new samples.
+class ProfileRing
+{
+    public:
+        static const std::size_t capacity = 1 << 14;
+
+        explicit ProfileRing(const uint32_t thread) : thread(thread), head(0), tail(0), dropped(0), samples()
+        {
+        }
+        void push(const ProfileSample &sample)
+        {
+            const uint64_t h = head.load(std::memory_order_relaxed);
+            if(h - tail.load(std::memory_order_acquire) == capacity)
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            samples[h % capacity] = sample;
+            samples[h % capacity].thread = thread;
+            head.store(h + 1, std::memory_order_release);
+        }
+        template<typename F>
+        void drain(F f)
+        {
+            const uint64_t h = head.load(std::memory_order_acquire);
+            for(uint64_t t = tail.load(std::memory_order_relaxed); t < h; ++t)
+            {
+                f(samples[t % capacity]);
+            }
+            tail.store(h, std::memory_order_release);
+        }
+        const uint32_t thread;
+        std::atomic<uint64_t> head;
+        std::atomic<uint64_t> tail;
+        std::atomic<uint64_t> dropped;
+    private:
+        std::array<ProfileSample, capacity> samples;
+};
+
+// Running totals for one system or zone, so the summary doesn't need the
+// samples kept around
+// Times go in a histogram with 8 buckets per power of two, so percentiles
+// come out within about 6% however long the run.
+class ProfileStats
+{
+    public:
+        static const int buckets = 8 + 61 * 8;
+
+        ProfileStats() : calls(0), total(0), entities(0), created(0), destroyed(0), added(0), removed(0), system(false), counts()
+        {
+            counts.fill(0);
+        }
+        void add(const ProfileSample &s)
+        {
+            const uint64_t time = s.end - s.begin;
+            calls++;
+            total += time;
+            entities += s.entities;
+            created += s.created;
+            destroyed += s.destroyed;
+            added += s.added;
+            removed += s.removed;
+            system = s.system;
+            counts[bucket(time)]++;
+        }
+        // Nanoseconds that fraction p of calls took no longer than
+        double percentile(const double p) const
+        {
+            const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p * calls)));
+            uint64_t seen = 0;
+            for(int b = 0; b < buckets; ++b)
+            {
+                seen += counts[b];
+                if(seen >= rank)
+                {
+                    return middle(b);
+                }
+            }
+            return 0.0;
+        }
+        uint64_t calls;
+        uint64_t total;
+        uint64_t entities;
+        uint64_t created;
+        uint64_t destroyed;
+        uint64_t added;
+        uint64_t removed;
+        bool system;
+    private:
+        // Below 8 exactly, then the top bit and the 3 bits after it
+        static int bucket(const uint64_t time)
+        {
+            if(time < 8)
+            {
+                return time;
+            }
+            int top = 3;
+            while((time >> (top + 1)) != 0)
+            {
+                top++;
+            }
+            return 8 + (top - 3) * 8 + ((time >> (top - 3)) & 7);
+        }
+        static double middle(const int b)
+        {
+            if(b < 8)
+            {
+                return b;
+            }
+            const int shift = (b - 8) / 8;
+            const double width = std::ldexp(1.0, shift);
+            return (8 + (b - 8) % 8) * width + width / 2;
+        }
+        std::array<uint64_t, buckets> counts;
+};
+
+// Collects samples from every thread's ring
+// Recording is off until start(). collect() adds everything recorded so
+// far to each system's and zone's totals and is called at the end of every
+// Manager::update(), when no other thread is recording. The samples
+// themselves are only kept for a trace, and only once keep_samples() has
+// said how many, so a long run doesn't keep growing.
+class Profiler
+{
+    public:
+        static Profiler& get()
+        {
+            static Profiler profiler;
+            return profiler;
+        }
+        void start()
+        {
+            recording.store(true, std::memory_order_relaxed);
+        }
+        void stop()
+        {
+            recording.store(false, std::memory_order_relaxed);
+        }
+        bool enabled() const
+        {
+            return recording.load(std::memory_order_relaxed);
+        }
+        uint64_t now() const
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+        }
+        void record(const ProfileSample &sample)
+        {
+            ring().push(sample);
+        }
+        // The changes the running system's commands count towards
+        static ProfileChanges*& changes()
+        {
+            static thread_local ProfileChanges *current = nullptr;
+            return current;
+        }
+        // Samples after the first n are left out of samples() and the trace
+        void keep_samples(const std::size_t n)
+        {
+            limit = n;
+            collected.reserve(std::min<std::size_t>(n, 1 << 16));
+        }
+        void collect()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for(auto &r : rings)
+            {
+                r->drain([this](const ProfileSample &s)
+                {
+                    auto found = stats.find(s.name);
+                    if(found == stats.end())
+                    {
+                        found = stats.emplace(s.name, ProfileStats()).first;
+                        order.push_back(s.name);
+                    }
+                    found->second.add(s);
+
+                    if(collected.size() < limit)
+                    {
+                        collected.push_back(s);
+                    }
+                    else
+                    {
+                        skipped++;
+                    }
+                });
+            }
+            frames++;
+        }
+        uint32_t frame() const
+        {
+            return frames;
+        }
+        // Samples lost to full rings
+        uint64_t dropped() const
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            uint64_t n = 0;
+            for(auto &r : rings)
+            {
+                n += r->dropped.load(std::memory_order_relaxed);
+            }
+            return n;
+        }
+        // What's been kept for the trace
+        const std::vector<ProfileSample>& samples() const
+        {
+            return collected;
+        }
+        // Samples left out of samples() once it was full
+        uint64_t skipped_samples() const
+        {
+            return skipped;
+        }
+        void clear()
+        {
+            collected.clear();
+            skipped = 0;
+            stats.clear();
+            order.clear();
+        }
+        // Chrome's trace event format, for chrome://tracing or Perfetto
+        void write_trace(std::ostream &out) const
+        {
+            out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [" << std::endl;
+            for(std::size_t i = 0; i < collected.size(); ++i)
+            {
+                const ProfileSample &s = collected[i];
+                out << "{\"name\": \"" << s.name << "\", \"cat\": \"" << (s.system ? "system" : "zone") << "\", \"ph\": \"X\""
+                    << ", \"ts\": " << s.begin / 1000.0 << ", \"dur\": " << (s.end - s.begin) / 1000.0
+                    << ", \"pid\": 0, \"tid\": " << s.thread << ", \"args\": {\"frame\": " << s.frame;
+                if(s.system == true)
+                {
+                    out << ", \"entities\": " << s.entities << ", \"created\": " << s.created << ", \"destroyed\": " << s.destroyed
+                        << ", \"added\": " << s.added << ", \"removed\": " << s.removed;
+                }
+                out << "}}" << (i + 1 < collected.size() ? "," : "") << std::endl;
+            }
+            out << "]}" << std::endl;
+        }
+        // Mean, median and p99 time of each system and zone, with the
+        // entities and structural changes of systems averaged per update
+        void print_summary(std::ostream &out) const
+        {
+            out << "Name                        Calls   Mean us    p50 us    p99 us  Entities  Created Destroyed    Added  Removed" << std::endl;
+            char line[256];
+            for(auto name : order)
+            {
+                const ProfileStats &t = stats.at(name);
+                const double n = t.calls;
+                const double p50 = t.percentile(0.5) / 1000.0;
+                const double p99 = t.percentile(0.99) / 1000.0;
+                if(t.system == true)
+                {
+                    snprintf(line, sizeof(line), "%-24s %9llu %9.1f %9.1f %9.1f %9.0f %8.1f %9.1f %8.1f %8.1f",
+                             name, static_cast<unsigned long long>(t.calls), t.total / n / 1000.0, p50, p99,
+                             t.entities / n, t.created / n, t.destroyed / n, t.added / n, t.removed / n);
+                }
+                else
+                {
+                    snprintf(line, sizeof(line), "  %-22s %9llu %9.1f %9.1f %9.1f",
+                             name, static_cast<unsigned long long>(t.calls), t.total / n / 1000.0, p50, p99);
+                }
+                out << line << std::endl;
+            }
+        }
+    private:
+        // Names are compared by what they say, the same zone name can be
+        // more than one literal
+        struct ByText
+        {
+            bool operator()(const char *a, const char *b) const
+            {
+                return std::strcmp(a, b) < 0;
+            }
+        };
+        Profiler() : epoch(std::chrono::steady_clock::now()), recording(false), frames(0), lock(), rings(), limit(0), skipped(0), collected(), stats(), order()
+        {
+        }
+        // Made the first time a thread records anything
+        ProfileRing& ring()
+        {
+            static thread_local ProfileRing *mine = nullptr;
+            if(mine == nullptr)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                rings.emplace_back(new ProfileRing(rings.size()));
+                mine = rings.back().get();
+            }
+            return *mine;
+        }
+        const std::chrono::steady_clock::time_point epoch;
+        std::atomic<bool> recording;
+        uint32_t frames;
+        mutable std::mutex lock;
+        std::vector<std::unique_ptr<ProfileRing>> rings;
+        std::size_t limit;
+        uint64_t skipped;
+        std::vector<ProfileSample> collected;
+        std::map<const char*, ProfileStats, ByText> stats;
+        // Names in the order they first turned up
+        std::vector<const char*> order;
+};
+
+// Records the time from here to the end of the scope
+class ProfileZone
+{
+    public:
+        explicit ProfileZone(const char *name) : name(name), begin(Profiler::get().enabled() ? Profiler::get().now() : 0)
+        {
+        }
+        ProfileZone(const ProfileZone&) = delete;
+        ProfileZone& operator=(const ProfileZone&) = delete;
+        ~ProfileZone()
+        {
+            Profiler &p = Profiler::get();
+            if(begin != 0 && p.enabled() == true)
+            {
+                p.record(ProfileSample{name, begin, p.now(), p.frame(), 0, false, 0, 0, 0, 0, 0});
+            }
+        }
+    private:
+        const char *name;
+        const uint64_t begin;
+};
+
+// Sets which system's changes count for the rest of the scope
+class ProfileContext
+{
+    public:
+        explicit ProfileContext(ProfileChanges *changes) : previous(Profiler::changes())
+        {
+            Profiler::changes() = changes;
+        }
+        ProfileContext(const ProfileContext&) = delete;
+        ProfileContext& operator=(const ProfileContext&) = delete;
+        ~ProfileContext()
+        {
+            Profiler::changes() = previous;
+        }
+    private:
+        ProfileChanges *previous;
+};
+
+// Counts one structural change towards the running system
+#define ECS_PROFILE_COUNT(change) \
+    do \
+    { \
+        if(Profiler::changes() != nullptr) \
+        { \
+            Profiler::changes()->change.fetch_add(1, std::memory_order_relaxed); \
+        } \
+    } while(false)
+
+#else
+
+#define ECS_ZONE(name)
+#define ECS_PROFILE_COUNT(change)
+
+#endif
+
+#endif
@@ -0,0 +1,408 @@
+#ifndef SOA_STORE_HPP
+#define SOA_STORE_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include "entity.hpp"
+#include "sparse_set.hpp"
+
+// Growable array of plain values, 32 byte aligned
+// Capacity is always a whole number of 32 byte blocks and the slack past
+// size() is kept zeroed, so SIMD loops can run to the end of the last block.
+template<typename T>
+class AlignedArray
+{
+    public:
+        static const std::size_t alignment = 32;
+        static const std::size_t block = alignment / sizeof(T);
+        static_assert(alignment % sizeof(T) == 0, "AlignedArray element must divide 32 bytes");
+        static_assert(std::is_trivially_copyable<T>::value, "AlignedArray element must be trivially copyable");
+
+        AlignedArray() : buffer(), items(nullptr), count(0), capacity(0)
+        {
+        }
+        AlignedArray(const AlignedArray&) = delete;
+        AlignedArray& operator=(const AlignedArray&) = delete;
+        T& operator[](const std::size_t i)
+        {
+            return items[i];
+        }
+        const T& operator[](const std::size_t i) const
+        {
+            return items[i];
+        }
+        T* data()
+        {
+            return items;
+        }
+        std::size_t size() const
+        {
+            return count;
+        }
+        // Size rounded up to a whole block
+        std::size_t padded_size() const
+        {
+            return (count + block - 1) / block * block;
+        }
+        void push_back(const T t)
+        {
+            if(count == capacity)
+            {
+                reserve(capacity == 0 ? block : 2 * capacity);
+            }
+            items[count++] = t;
+        }
+        void pop_back()
+        {
+            assert(count > 0);
+            items[--count] = T();
+        }
+        void clear()
+        {
+            while(count > 0)
+            {
+                pop_back();
+            }
+        }
+        void reserve(std::size_t n)
+        {
+            n = (n + block - 1) / block * block;
+            if(n <= capacity)
+            {
+                return;
+            }
+
+            std::unique_ptr<unsigned char[]> new_buffer(new unsigned char[n * sizeof(T) + alignment]);
+            const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(new_buffer.get());
+            T *new_items = reinterpret_cast<T*>((address + alignment - 1) / alignment * alignment);
+
+            std::memset(new_items, 0, n * sizeof(T));
+            if(count > 0)
+            {
+                std::memcpy(new_items, items, count * sizeof(T));
+            }
+
+            buffer.swap(new_buffer);
+            items = new_items;
+            capacity = n;
+        }
+    private:
+        std::unique_ptr<unsigned char[]> buffer;
+        T *items;
+        std::size_t count;
+        std::size_t capacity;
+};
+
+// Structure of arrays layout
+// By default a component is stored whole, one struct after another. A
+// component opts in to being split into one AlignedArray per field with
+// ECS_SOA1/ECS_SOA2/ECS_SOA3 after its definition:
+//
+// ECS_SOA3(Transform, x, y, rotation)
+//
+// Stores then hand out a Ref proxy instead of a T&, which has the same
+// fields as references, so transform.x and transform->x keep working.
+// A ConstRef is handed out instead of a const T&.
+template<typename T>
+class SoALayout
+{
+    public:
+        static const bool enabled = false;
+};
+
+#define ECS_SOA_FIELD(T, f) typedef decltype(T::f) f##_type;
+#define ECS_SOA_QUAL(f) typename std::conditional<Const, const f##_type, f##_type>::type
+
+#define ECS_SOA1(T, a) \
+template<> \
+class SoALayout<T> \
+{ \
+    public: \
+        static const bool enabled = true; \
+        ECS_SOA_FIELD(T, a) \
+        template<bool Const> \
+        class Proxy \
+        { \
+            public: \
+                explicit Proxy(ECS_SOA_QUAL(a) &a##_) : a(a##_) \
+                { \
+                } \
+                Proxy* operator->() \
+                { \
+                    return this; \
+                } \
+                Proxy& operator=(const T &t) \
+                { \
+                    a = t.a; \
+                    return *this; \
+                } \
+                operator T() const \
+                { \
+                    T t; \
+                    t.a = a; \
+                    return t; \
+                } \
+                ECS_SOA_QUAL(a) &a; \
+        }; \
+        typedef Proxy<false> Ref; \
+        typedef Proxy<true> ConstRef; \
+        class Columns \
+        { \
+            public: \
+                Ref at(const std::size_t i) \
+                { \
+                    return Ref(a[i]); \
+                } \
+                ConstRef at(const std::size_t i) const \
+                { \
+                    return ConstRef(a[i]); \
+                } \
+                std::size_t size() const \
+                { \
+                    return a.size(); \
+                } \
+                void push_back(const T &t) \
+                { \
+                    a.push_back(t.a); \
+                } \
+                void pop_back() \
+                { \
+                    a.pop_back(); \
+                } \
+                void move(const std::size_t to, const std::size_t from) \
+                { \
+                    a[to] = a[from]; \
+                } \
+                void swap(const std::size_t i, const std::size_t j) \
+                { \
+                    std::swap(a[i], a[j]); \
+                } \
+                void reserve(const std::size_t n) \
+                { \
+                    a.reserve(n); \
+                } \
+                AlignedArray<a##_type> a; \
+        }; \
+};
+
+#define ECS_SOA2(T, a, b) \
+template<> \
+class SoALayout<T> \
+{ \
+    public: \
+        static const bool enabled = true; \
+        ECS_SOA_FIELD(T, a) \
+        ECS_SOA_FIELD(T, b) \
+        template<bool Const> \
+        class Proxy \
+        { \
+            public: \
+                Proxy(ECS_SOA_QUAL(a) &a##_, ECS_SOA_QUAL(b) &b##_) : a(a##_), b(b##_) \
+                { \
+                } \
+                Proxy* operator->() \
+                { \
+                    return this; \
+                } \
+                Proxy& operator=(const T &t) \
+                { \
+                    a = t.a; \
+                    b = t.b; \
+                    return *this; \
+                } \
+                operator T() const \
+                { \
+                    T t; \
+                    t.a = a; \
+                    t.b = b; \
+                    return t; \
+                } \
+                ECS_SOA_QUAL(a) &a; \
+                ECS_SOA_QUAL(b) &b; \
+        }; \
+        typedef Proxy<false> Ref; \
+        typedef Proxy<true> ConstRef; \
+        class Columns \
+        { \
+            public: \
+                Ref at(const std::size_t i) \
+                { \
+                    return Ref(a[i], b[i]); \
+                } \
+                ConstRef at(const std::size_t i) const \
+                { \
+                    return ConstRef(a[i], b[i]); \
+                } \
+                std::size_t size() const \
+                { \
+                    return a.size(); \
+                } \
+                void push_back(const T &t) \
+                { \
+                    a.push_back(t.a); \
+                    b.push_back(t.b); \
+                } \
+                void pop_back() \
+                { \
+                    a.pop_back(); \
+                    b.pop_back(); \
+                } \
+                void move(const std::size_t to, const std::size_t from) \
+                { \
+                    a[to] = a[from]; \
+                    b[to] = b[from]; \
+                } \
+                void swap(const std::size_t i, const std::size_t j) \
+                { \
+                    std::swap(a[i], a[j]); \
+                    std::swap(b[i], b[j]); \
+                } \
+                void reserve(const std::size_t n) \
+                { \
+                    a.reserve(n); \
+                    b.reserve(n); \
+                } \
+                AlignedArray<a##_type> a; \
+                AlignedArray<b##_type> b; \
+        }; \
+};
+
+#define ECS_SOA3(T, a, b, c) \
+template<> \
+class SoALayout<T> \
+{ \
+    public: \
+        static const bool enabled = true; \
+        ECS_SOA_FIELD(T, a) \
+        ECS_SOA_FIELD(T, b) \
+        ECS_SOA_FIELD(T, c) \
+        template<bool Const> \
+        class Proxy \
+        { \
+            public: \
+                Proxy(ECS_SOA_QUAL(a) &a##_, ECS_SOA_QUAL(b) &b##_, ECS_SOA_QUAL(c) &c##_) : a(a##_), b(b##_), c(c##_) \
+                { \
+                } \
+                Proxy* operator->() \
+                { \
+                    return this; \
+                } \
+                Proxy& operator=(const T &t) \
+                { \
+                    a = t.a; \
+                    b = t.b; \
+                    c = t.c; \
+                    return *this; \
+                } \
+                operator T() const \
+                { \
+                    T t; \
+                    t.a = a; \
+                    t.b = b; \
+                    t.c = c; \
+                    return t; \
+                } \
+                ECS_SOA_QUAL(a) &a; \
+                ECS_SOA_QUAL(b) &b; \
+                ECS_SOA_QUAL(c) &c; \
+        }; \
+        typedef Proxy<false> Ref; \
+        typedef Proxy<true> ConstRef; \
+        class Columns \
+        { \
+            public: \
+                Ref at(const std::size_t i) \
+                { \
+                    return Ref(a[i], b[i], c[i]); \
+                } \
+                ConstRef at(const std::size_t i) const \
+                { \
+                    return ConstRef(a[i], b[i], c[i]); \
+                } \
+                std::size_t size() const \
+                { \
+                    return a.size(); \
+                } \
+                void push_back(const T &t) \
+                { \
+                    a.push_back(t.a); \
+                    b.push_back(t.b); \
+                    c.push_back(t.c); \
+                } \
+                void pop_back() \
+                { \
+                    a.pop_back(); \
+                    b.pop_back(); \
+                    c.pop_back(); \
+                } \
+                void move(const std::size_t to, const std::size_t from) \
+                { \
+                    a[to] = a[from]; \
+                    b[to] = b[from]; \
+                    c[to] = c[from]; \
+                } \
+                void swap(const std::size_t i, const std::size_t j) \
+                { \
+                    std::swap(a[i], a[j]); \
+                    std::swap(b[i], b[j]); \
+                    std::swap(c[i], c[j]); \
+                } \
+                void reserve(const std::size_t n) \
+                { \
+                    a.reserve(n); \
+                    b.reserve(n); \
+                    c.reserve(n); \
+                } \
+                AlignedArray<a##_type> a; \
+                AlignedArray<b##_type> b; \
+                AlignedArray<c##_type> c; \
+        }; \
+};
+
+// Pointer-like handle into a SoA store, nullptr when the entity has no T
+// SoAPtr<const T> is the read only version
+template<typename T>
+class SoAPtr
+{
+    public:
+        typedef typename std::remove_const<T>::type Value;
+        typedef typename std::conditional<std::is_const<T>::value, const typename SoALayout<Value>::Columns, typename SoALayout<Value>::Columns>::type Columns;
+        typedef typename std::conditional<std::is_const<T>::value, typename SoALayout<Value>::ConstRef, typename SoALayout<Value>::Ref>::type Ref;
+
+        SoAPtr(std::nullptr_t) : columns(nullptr), slot(0)
+        {
+        }
+        SoAPtr(Columns *c, const std::size_t s) : columns(c), slot(s)
+        {
+        }
+        Ref operator*() const
+        {
+            return columns->at(slot);
+        }
+        Ref operator->() const
+        {
+            return columns->at(slot);
+        }
+        explicit operator bool() const
+        {
+            return columns != nullptr;
+        }
+        bool operator==(std::nullptr_t) const
+        {
+            return columns == nullptr;
+        }
+        bool operator!=(std::nullptr_t) const
+        {
+            return columns != nullptr;
+        }
+    private:
+        Columns *columns;
+        std::size_t slot;
+};
+
+#endif
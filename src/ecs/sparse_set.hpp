@@ -0,0 +1,83 @@
+#ifndef SPARSE_SET_HPP
+#define SPARSE_SET_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Maps an entity to a slot in some packed array.
+// The sparse side is split into fixed size pages that are only allocated
+// once an entity inside them is used, so a store with a handful of entities
+// at high indices doesn't pay for a million empty slots.
+class SparseIndex
+{
+    public:
+        static const uint32_t npos = UINT32_MAX;
+        static const uint32_t page_bits = 12;
+        static const uint32_t page_size = 1 << page_bits;
+
+        SparseIndex() : pages()
+        {
+        }
+        uint32_t get(const uint32_t index) const
+        {
+            const uint32_t page = index >> page_bits;
+            if(page >= pages.size() || pages[page] == nullptr)
+            {
+                return npos;
+            }
+            return pages[page][index & (page_size - 1)];
+        }
+        void set(const uint32_t index, const uint32_t slot)
+        {
+            const uint32_t page = index >> page_bits;
+            if(page >= pages.size())
+            {
+                pages.resize(page + 1);
+            }
+            if(pages[page] == nullptr)
+            {
+                allocate(page);
+            }
+            pages[page][index & (page_size - 1)] = slot;
+        }
+        void erase(const uint32_t index)
+        {
+            const uint32_t page = index >> page_bits;
+            assert(page < pages.size() && pages[page] != nullptr);
+            pages[page][index & (page_size - 1)] = npos;
+        }
+        void clear()
+        {
+            pages.clear();
+        }
+        // Allocates every page for indices below n now, so set() won't
+        void reserve(const std::size_t n)
+        {
+            const std::size_t count = (n + page_size - 1) >> page_bits;
+            if(pages.size() < count)
+            {
+                pages.resize(count);
+            }
+            for(std::size_t page = 0; page < count; ++page)
+            {
+                if(pages[page] == nullptr)
+                {
+                    allocate(page);
+                }
+            }
+        }
+    private:
+        void allocate(const std::size_t page)
+        {
+            pages[page].reset(new uint32_t[page_size]);
+            for(uint32_t i = 0; i < page_size; ++i)
+            {
+                pages[page][i] = npos;
+            }
+        }
+        std::vector<std::unique_ptr<uint32_t[]>> pages;
+};
+
+#endif
@@ -1,40 +1,352 @@
 #ifndef SYSTEM_MANAGER_HPP
 #define SYSTEM_MANAGER_HPP
 
+#include <algorithm>
+#include <array>
+#include <bitset>
 #include <cassert>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
 #include <vector>
 #include <memory>
+#ifdef __GNUG__
+#include <cxxabi.h>
+#endif
+#include "alloc_tracker.hpp"
+#include "entity.hpp"
+#include "entity_set.hpp"
+#include "event_bus.hpp"
+#include "perf_counters.hpp"
+#include "profiler.hpp"
+#include "thread_pool.hpp"
+
+#define MAX_RESOURCES 16
 
-typedef uint32_t Entity;
-typedef uint32_t Component;
 class SystemManager;
 class Manager;
 
+// Readable where the compiler can demangle it
+template<typename T>
+std::string type_name()
+{
+#ifdef __GNUG__
+    int status = 0;
+    std::unique_ptr<char, void(*)(void*)> name(abi::__cxa_demangle(typeid(T).name(), nullptr, nullptr, &status), std::free);
+    if(status == 0)
+    {
+        return name.get();
+    }
+#endif
+    return typeid(T).name();
+}
+
+// What a system reads and writes, so the scheduler knows which systems can
+// run at the same time. Components and events are named by type. Anything
+// else systems share, like rand() or a renderer, is a resource numbered by
+// the game. Events are treated like components, so a reader is kept after
+// the writers registered before it.
+// Recording commands needs nothing, each thread gets its own buffer, but
+// creating entities hands out ids straight away, so it clashes with systems
+// that look up whether entities are alive.
+//
+// access.read<Transform, Size>();
+// access.write<Health, CollisionEvent>();
+class Access
+{
+    public:
+        typedef std::bitset<MAX_COMPONENTS + MAX_EVENTS + MAX_RESOURCES> Set;
+
+        Access() : reads(), writes(), creates(false), looks_up(false)
+        {
+        }
+        template<typename... Ts>
+        void read()
+        {
+            const std::size_t bits[] = {bit<Ts>()...};
+            for(auto b : bits)
+            {
+                reads.set(b);
+            }
+        }
+        template<typename... Ts>
+        void write()
+        {
+            const std::size_t bits[] = {bit<Ts>()...};
+            for(auto b : bits)
+            {
+                writes.set(b);
+            }
+        }
+        void read_resource(const std::size_t r)
+        {
+            assert(r < MAX_RESOURCES);
+            reads.set(MAX_COMPONENTS + MAX_EVENTS + r);
+        }
+        void write_resource(const std::size_t r)
+        {
+            assert(r < MAX_RESOURCES);
+            writes.set(MAX_COMPONENTS + MAX_EVENTS + r);
+        }
+        // Uses commands.create()
+        void create_entities()
+        {
+            creates = true;
+        }
+        // Uses manager->em, e.g. em.alive()
+        void read_entities()
+        {
+            looks_up = true;
+        }
+        // Nothing declared means anything could be touched
+        bool declared() const
+        {
+            return reads.any() || writes.any() || creates == true || looks_up == true;
+        }
+        bool conflicts(const Access &other) const
+        {
+            if(declared() == false || other.declared() == false)
+            {
+                return true;
+            }
+            return (writes & (other.reads | other.writes)).any() ||
+                   (other.writes & reads).any() ||
+                   (creates == true && other.looks_up == true) ||
+                   (looks_up == true && other.creates == true);
+        }
+        void print(std::ostream &out) const
+        {
+            print_bits(out, " reads", reads);
+            print_bits(out, " writes", writes);
+            if(creates == true)
+            {
+                out << " creates entities";
+            }
+            if(looks_up == true)
+            {
+                out << " looks up entities";
+            }
+        }
+        Set reads;
+        Set writes;
+        bool creates;
+        bool looks_up;
+    private:
+        // Also remembers the type's name for print()
+        template<typename T>
+        static std::size_t bit()
+        {
+            const std::size_t b = std::is_base_of<EventType<T>, T>::value ? MAX_COMPONENTS + T::id : T::id;
+            if(names()[b].empty() == true)
+            {
+                names()[b] = type_name<T>();
+            }
+            return b;
+        }
+        static std::array<std::string, MAX_COMPONENTS + MAX_EVENTS + MAX_RESOURCES>& names()
+        {
+            static std::array<std::string, MAX_COMPONENTS + MAX_EVENTS + MAX_RESOURCES> n;
+            return n;
+        }
+        // Resources are shown by number
+        static void print_bits(std::ostream &out, const char *label, const Set &bits)
+        {
+            if(bits.none())
+            {
+                return;
+            }
+            out << label;
+            for(std::size_t b = 0; b < bits.size(); ++b)
+            {
+                if(bits.test(b) == false)
+                {
+                    continue;
+                }
+                if(b < MAX_COMPONENTS + MAX_EVENTS)
+                {
+                    out << " " << names()[b];
+                }
+                else
+                {
+                    out << " resource " << b - MAX_COMPONENTS - MAX_EVENTS;
+                }
+            }
+        }
+};
+
 class System
 {
     public:
+        System() : entities(), required(), access(), pinned(false), name(), manager(nullptr), last_run(0), busy(0)
+        {
+        }
+        virtual ~System() = default;
         virtual void update(const float dt) = 0;
+        // Called once the system has a manager, e.g. to register observers
+        virtual void init()
+        {
+        }
+        // Room in the system's own buffers for n entities, and anything else
+        // to set up before the game starts, e.g. Manager::prepare() for the
+        // entities it creates. Called by Manager::reserve().
+        virtual void reserve(const std::size_t)
+        {
+        }
         void remove_entity(const Entity e)
         {
             entities.erase(e);
         }
-        std::set<Entity> entities;
-        std::set<Component> required;
+        EntitySet entities;
+        Signature required;
+        // Declared in the constructor, see Access
+        Access access;
+        // Always run on the thread calling Manager::update(), e.g. rendering
+        bool pinned;
+        std::string name;
         Manager *manager;
+        // Tick of the previous update(), for view<...>().changed<T>(last_run)
+        Tick last_run;
+        // Wall time spent in update() so far, kept by the SystemManager
+        std::chrono::steady_clock::duration busy;
+#ifdef ECS_PROFILE
+        // Commands recorded during the current update()
+        ProfileChanges changes;
+#endif
+#ifdef ECS_PERF_COUNTERS
+        // Hardware counters for every update() so far
+        PerfTotals perf;
+#endif
+#ifdef ECS_TRACK_ALLOCS
+        // Heap allocations made by every update() so far
+        AllocTotals allocs;
+#endif
 };
 
 class SystemManager
 {
     public:
-        SystemManager() : systems({})
+        SystemManager() : systems({}), by_component(), unfiltered({}), stages({}), pool(nullptr), scheduled(0)
         {
         }
-        void update(const float dt)
+        // next_tick() starts a new tick for each system, or each stage when
+        // running in parallel, so a system's writes are stamped after the
+        // last_run of every system that ran before it
+        // Without a pool of at least two threads systems run one after
+        // another in the order they were added.
+        template<typename F>
+        void update(const float dt, F next_tick)
         {
-            for(auto &s : systems)
+            if(pool == nullptr || pool->size() < 2)
             {
-                s->update(dt);
+                for(auto &s : systems)
+                {
+                    const Tick now = next_tick();
+                    run(s, dt);
+                    s->last_run = now;
+                }
+                return;
+            }
+
+            for(auto &stage : schedule())
+            {
+                const Tick now = next_tick();
+                if(stage.size() == 1)
+                {
+                    run(stage[0], dt);
+                }
+                else
+                {
+                    TaskGroup group;
+                    for(auto s : stage)
+                    {
+                        if(s->pinned == false)
+                        {
+                            pool->run(group, [s, dt]() {run(s, dt);});
+                        }
+                    }
+                    for(auto s : stage)
+                    {
+                        if(s->pinned == true)
+                        {
+                            run(s, dt);
+                        }
+                    }
+                    pool->wait(group);
+                }
+                for(auto s : stage)
+                {
+                    s->last_run = now;
+                }
+            }
+        }
+        void set_pool(ThreadPool *p)
+        {
+            pool = p;
+        }
+        // Room in every system for n entities, see EntitySet::reserve()
+        void reserve(const std::size_t n)
+        {
+            for(auto s : systems)
+            {
+                s->entities.reserve(n + 1);
+                s->reserve(n);
+            }
+        }
+        // In the order they were added
+        const std::vector<System*>& get_systems() const
+        {
+            return systems;
+        }
+        // Systems grouped into stages that run one after another, the
+        // systems in a stage running at the same time
+        // A system goes in the stage after the latest one holding an earlier
+        // system it conflicts with, so conflicting systems keep the order
+        // they were added in and everything else runs as early as it can.
+        const std::vector<std::vector<System*>>& schedule()
+        {
+            if(scheduled == systems.size())
+            {
+                return stages;
+            }
+
+            stages.clear();
+            std::vector<std::size_t> stage_of(systems.size(), 0);
+            for(std::size_t j = 0; j < systems.size(); ++j)
+            {
+                std::size_t stage = 0;
+                for(std::size_t i = 0; i < j; ++i)
+                {
+                    if(systems[i]->access.conflicts(systems[j]->access) == true)
+                    {
+                        stage = std::max(stage, stage_of[i] + 1);
+                    }
+                }
+                stage_of[j] = stage;
+                if(stage == stages.size())
+                {
+                    stages.emplace_back();
+                }
+                stages[stage].push_back(systems[j]);
+            }
+            scheduled = systems.size();
+            return stages;
+        }
+        void print_schedule(std::ostream &out)
+        {
+            out << "Schedule:" << std::endl;
+            const auto &all = schedule();
+            for(std::size_t i = 0; i < all.size(); ++i)
+            {
+                out << "  Stage " << i << ":" << std::endl;
+                for(auto s : all[i])
+                {
+                    out << "    " << s->name << (s->pinned ? " (pinned)" : "");
+                    s->access.print(out);
+                    out << std::endl;
+                }
             }
         }
         void print()
@@ -51,39 +363,73 @@ class SystemManager
                 }
 
                 std::cout << " Required:";
-                for(auto c : s->required)
+                for(Component c = 0; c < MAX_COMPONENTS; ++c)
                 {
-                    std::cout << " " << c;
+                    if(s->required.test(c))
+                    {
+                        std::cout << " " << c;
+                    }
                 }
 
                 std::cout << std::endl;
             }
         }
-        void remove_entity(const Entity e)
+        // Only systems the signature matches can hold the entity
+        void remove_entity(const Entity e, const Signature &signature)
         {
-            for(auto &system : systems)
+            for(auto &s : systems)
             {
-                system->remove_entity(e);
+                if((signature & s->required) == s->required)
+                {
+                    s->remove_entity(e);
+                }
             }
         }
-        void update_entity(const Entity e, const std::set<Component> c)
+        void update_entity(const Entity e, const Signature &signature)
         {
             for(auto &s : systems)
             {
-                bool valid = true;
-                for(auto r : s->required)
+                if((signature & s->required) == s->required)
                 {
-                    if(c.find(r) == c.end())
-                    {
-                        valid = false;
-                        break;
-                    }
+                    s->entities.insert(e);
                 }
-                if(valid == true)
+            }
+        }
+        // Only systems that require c can start matching when c is added,
+        // along with systems that require nothing and so match everything,
+        // the same as when an entity is created with its components
+        void component_added(const Entity e, const Component c, const Signature &signature)
+        {
+            for(auto s : by_component[c])
+            {
+                if((signature & s->required) == s->required)
                 {
                     s->entities.insert(e);
                 }
             }
+            for(auto s : unfiltered)
+            {
+                s->entities.insert(e);
+            }
+        }
+        // and only those can stop matching when it's removed
+        void component_removed(const Entity e, const Component c)
+        {
+            for(auto s : by_component[c])
+            {
+                s->remove_entity(e);
+            }
+        }
+        // For entities that were created with exactly this signature
+        void add_entities(const std::vector<Entity> &es, const Signature &signature)
+        {
+            for(auto &s : systems)
+            {
+                if((signature & s->required) == s->required)
+                {
+                    s->entities.insert(es.begin(), es.end());
+                }
+            }
         }
         template<typename T>
         T* get_system()
@@ -103,10 +449,63 @@ class SystemManager
         void add_system(T* t)
         {
             static_assert(std::is_base_of<System, T>::value, "System must derive from System base class");
+            t->name = type_name<T>();
             systems.push_back(t);
+
+            each_component(t->required, [this, t](Component c)
+            {
+                by_component[c].push_back(t);
+            });
+            if(t->required.none() == true)
+            {
+                unfiltered.push_back(t);
+            }
         }
     private:
+        static void run(System *s, const float dt)
+        {
+            const auto start = std::chrono::steady_clock::now();
+#ifdef ECS_PROFILE
+            Profiler &profiler = Profiler::get();
+            const uint64_t begin = profiler.enabled() ? profiler.now() : 0;
+#endif
+#ifdef ECS_PERF_COUNTERS
+            s->perf.entities.fetch_add(s->entities.size(), std::memory_order_relaxed);
+            s->perf.updates.fetch_add(1, std::memory_order_relaxed);
+#endif
+            {
+#ifdef ECS_PROFILE
+                ProfileContext context(&s->changes);
+#endif
+#ifdef ECS_PERF_COUNTERS
+                PerfScope counters(&s->perf);
+#endif
+#ifdef ECS_TRACK_ALLOCS
+                AllocScope allocations(&s->allocs);
+#endif
+                s->update(dt);
+            }
+#ifdef ECS_PROFILE
+            ProfileChanges &c = s->changes;
+            const ProfileSample sample{s->name.c_str(), begin, profiler.now(), profiler.frame(), 0, true,
+                                       static_cast<uint32_t>(s->entities.size()),
+                                       c.created.exchange(0), c.destroyed.exchange(0), c.added.exchange(0), c.removed.exchange(0)};
+            if(begin != 0 && profiler.enabled() == true)
+            {
+                profiler.record(sample);
+            }
+#endif
+            s->busy += std::chrono::steady_clock::now() - start;
+        }
         std::vector<System*> systems;
+        // Systems indexed by each component they require
+        std::array<std::vector<System*>, MAX_COMPONENTS> by_component;
+        // Systems that require no components
+        std::vector<System*> unfiltered;
+        std::vector<std::vector<System*>> stages;
+        ThreadPool *pool;
+        // How many systems the stages were worked out for
+        std::size_t scheduled;
 };
 
 #endif
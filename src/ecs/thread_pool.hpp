@@ -0,0 +1,346 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "alloc_tracker.hpp"
+#include "perf_counters.hpp"
+#include "profiler.hpp"
+
+class ThreadPool;
+
+#if defined(ECS_PROFILE) || defined(ECS_PERF_COUNTERS) || defined(ECS_TRACK_ALLOCS)
+// What the thread splitting work off is measuring, so whatever the tasks
+// do counts towards the same system on whichever thread they run
+class TaskContext
+{
+    public:
+        TaskContext()
+        {
+#ifdef ECS_PROFILE
+            changes = Profiler::changes();
+#endif
+#ifdef ECS_PERF_COUNTERS
+            perf = PerfCounters::local().target();
+#endif
+#ifdef ECS_TRACK_ALLOCS
+            allocs = AllocTracker::target();
+#endif
+        }
+        template<typename F>
+        void run(F f) const
+        {
+#ifdef ECS_PROFILE
+            ProfileContext context(changes);
+            ECS_ZONE("parallel_for");
+#endif
+#ifdef ECS_PERF_COUNTERS
+            PerfScope counters(perf);
+#endif
+#ifdef ECS_TRACK_ALLOCS
+            AllocScope allocations(allocs);
+#endif
+            f();
+        }
+    private:
+#ifdef ECS_PROFILE
+        ProfileChanges *changes;
+#endif
+#ifdef ECS_PERF_COUNTERS
+        PerfTotals *perf;
+#endif
+#ifdef ECS_TRACK_ALLOCS
+        AllocTotals *allocs;
+#endif
+};
+#endif
+
+// Tasks run together that something waits on with ThreadPool::wait()
+class TaskGroup
+{
+    public:
+        TaskGroup() : pending(0)
+        {
+        }
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+        bool done() const
+        {
+            return pending.load(std::memory_order_acquire) == 0;
+        }
+    private:
+        friend class ThreadPool;
+        std::atomic<std::size_t> pending;
+};
+
+// Thread pool with a task queue per thread
+// Each queue is a ring behind its own mutex, so every push, pop and take
+// from another thread's queue locks, but threads only contend when they
+// touch the same queue. A thread pushes and pops its own tasks at the back,
+// so it works through what it split off most recently while that's still
+// in cache, and idle threads take from the front of someone else's. The
+// thread that made the pool counts as worker 0 and only runs tasks while it
+// waits on a group, so a pool of n has n - 1 threads. Waiting runs tasks
+// and spins with yield() when there are none rather than blocking, so tasks
+// can split off more tasks and wait on them without running out of
+// threads. Idle workers sleep on a condition variable, and every push
+// takes sleep_lock to wake one.
+class ThreadPool
+{
+    public:
+        typedef std::function<void()> Task;
+
+        // Below about this many items splitting work costs more than it saves
+        static const std::size_t default_grain = 4096;
+
+        explicit ThreadPool(const std::size_t count) : queues(), threads(), sleep_lock(), wake(), queued(0), stopping(false), next(0)
+        {
+            const std::size_t n = std::max<std::size_t>(1, count);
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                queues.emplace_back(new Queue());
+            }
+            worker_of() = Worker{this, 0};
+            for(std::size_t i = 1; i < n; ++i)
+            {
+                threads.emplace_back([this, i]() {work(i);});
+            }
+        }
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> guard(sleep_lock);
+                stopping = true;
+            }
+            wake.notify_all();
+            for(auto &t : threads)
+            {
+                t.join();
+            }
+            if(worker_of().pool == this)
+            {
+                worker_of() = Worker{nullptr, 0};
+            }
+        }
+        // Including the thread that made the pool
+        std::size_t size() const
+        {
+            return queues.size();
+        }
+        // 0 to size() - 1 on this pool's threads, 0 anywhere else
+        std::size_t current_worker() const
+        {
+            const Worker &w = worker_of();
+            return w.pool == this ? w.index : 0;
+        }
+        // Queued on the calling thread's queue, or spread round the workers
+        // when called from outside the pool
+        void run(TaskGroup &group, Task task)
+        {
+            group.pending.fetch_add(1, std::memory_order_relaxed);
+
+            const Worker &w = worker_of();
+            const std::size_t q = w.pool == this ? w.index : next++ % queues.size();
+            queued.fetch_add(1, std::memory_order_release);
+            {
+                std::lock_guard<std::mutex> guard(queues[q]->lock);
+                queues[q]->push_back(Job{std::move(task), &group});
+            }
+            {
+                // Taken so a worker can't miss the wake up between checking
+                // for work and going to sleep
+                std::lock_guard<std::mutex> guard(sleep_lock);
+            }
+            wake.notify_one();
+        }
+        // Runs tasks, this group's or anyone's, until the group is done
+        void wait(TaskGroup &group)
+        {
+            const std::size_t self = current_worker();
+            while(group.done() == false)
+            {
+                if(run_one(self) == false)
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }
+        // Calls f(begin, end) over [0, n) in ranges of about grain, on as
+        // many threads as are free, and returns once they've all finished
+        // Ranges are multiples of align so callers can line them up with
+        // blocks of their own.
+        template<typename F>
+        void parallel_for(const std::size_t n, std::size_t grain, F f, const std::size_t align = 1)
+        {
+            grain = std::max(align, (grain + align - 1) / align * align);
+            if(n <= grain || size() < 2)
+            {
+                f(std::size_t(0), n);
+                return;
+            }
+
+#if defined(ECS_PROFILE) || defined(ECS_PERF_COUNTERS) || defined(ECS_TRACK_ALLOCS)
+            const TaskContext context;
+#endif
+            auto range = [&](const std::size_t begin)
+            {
+                const std::size_t end = std::min(n, begin + grain);
+#if defined(ECS_PROFILE) || defined(ECS_PERF_COUNTERS) || defined(ECS_TRACK_ALLOCS)
+                context.run([&]() {f(begin, end);});
+#else
+                f(begin, end);
+#endif
+            };
+
+            // Two words per task, small enough that std::function keeps
+            // them inline rather than allocating
+            TaskGroup group;
+            for(std::size_t begin = 0; begin < n; begin += grain)
+            {
+                run(group, [&range, begin]() {range(begin);});
+            }
+            wait(group);
+        }
+    private:
+        struct Job
+        {
+            Task task;
+            TaskGroup *group;
+        };
+        // A ring of jobs that only ever grows, where a deque would keep
+        // allocating and freeing blocks as tasks come and go
+        struct Queue
+        {
+            Queue() : lock(), jobs(16), first(0), count(0)
+            {
+            }
+            bool empty() const
+            {
+                return count == 0;
+            }
+            void push_back(Job job)
+            {
+                if(count == jobs.size())
+                {
+                    std::vector<Job> bigger(2 * jobs.size());
+                    for(std::size_t i = 0; i < count; ++i)
+                    {
+                        bigger[i] = std::move(jobs[(first + i) % jobs.size()]);
+                    }
+                    jobs.swap(bigger);
+                    first = 0;
+                }
+                jobs[(first + count) % jobs.size()] = std::move(job);
+                count++;
+            }
+            Job pop_back()
+            {
+                count--;
+                return std::move(jobs[(first + count) % jobs.size()]);
+            }
+            Job pop_front()
+            {
+                Job job = std::move(jobs[first]);
+                first = (first + 1) % jobs.size();
+                count--;
+                return job;
+            }
+            std::mutex lock;
+            std::vector<Job> jobs;
+            std::size_t first;
+            std::size_t count;
+        };
+        struct Worker
+        {
+            const ThreadPool *pool;
+            std::size_t index;
+        };
+        static Worker& worker_of()
+        {
+            static thread_local Worker w{nullptr, 0};
+            return w;
+        }
+        // Own queue from the back, then everyone else's from the front
+        bool pop(const std::size_t self, Job &job)
+        {
+            {
+                Queue &q = *queues[self];
+                std::lock_guard<std::mutex> guard(q.lock);
+                if(q.empty() == false)
+                {
+                    job = q.pop_back();
+                    return true;
+                }
+            }
+            for(std::size_t i = 1; i < queues.size(); ++i)
+            {
+                Queue &q = *queues[(self + i) % queues.size()];
+                std::lock_guard<std::mutex> guard(q.lock);
+                if(q.empty() == false)
+                {
+                    job = q.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+        bool run_one(const std::size_t self)
+        {
+            Job job;
+            if(pop(self, job) == false)
+            {
+                return false;
+            }
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            job.task();
+            job.group->pending.fetch_sub(1, std::memory_order_release);
+            return true;
+        }
+        void work(const std::size_t self)
+        {
+            worker_of() = Worker{this, self};
+            while(true)
+            {
+                if(run_one(self) == true)
+                {
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> guard(sleep_lock);
+                wake.wait(guard, [this]() {return stopping == true || queued.load(std::memory_order_acquire) > 0;});
+                if(stopping == true)
+                {
+                    return;
+                }
+            }
+        }
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::vector<std::thread> threads;
+        std::mutex sleep_lock;
+        std::condition_variable wake;
+        std::atomic<std::size_t> queued;
+        bool stopping;
+        std::atomic<std::size_t> next;
+};
+
+// ECS_THREADS if it's set, otherwise one per core
+inline std::size_t default_threads()
+{
+    const char *env = std::getenv("ECS_THREADS");
+    if(env != nullptr && std::atoi(env) > 0)
+    {
+        return std::atoi(env);
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef VIEW_HPP
+#define VIEW_HPP
+
+#include <cstddef>
+#include <type_traits>
+#include "entity.hpp"
+#include "thread_pool.hpp"
+
+// Marks a view argument as optional
+// manager.view<Transform, Optional<Velocity>>() visits every entity with a
+// Transform and hands out a Velocity* that is nullptr when it has none
+template<typename T>
+class Optional
+{
+};
+
+// Stores mark a component as changed when they hand out write access to it
+// Reads go through read_component() and leave it alone.
+template<bool Write>
+class StoreAccess
+{
+    public:
+        template<typename S, typename... Args>
+        static auto get(S *store, Args... args)
+        {
+            return store->get_component(args...);
+        }
+};
+
+template<>
+class StoreAccess<false>
+{
+    public:
+        template<typename S, typename... Args>
+        static auto get(S *store, Args... args)
+        {
+            return store->read_component(args...);
+        }
+};
+
+// P is whatever the store hands out for a component, T* or a SoAPtr<T>
+// view<const T>() only reads T, so it isn't marked as changed
+template<typename T>
+class ViewArg
+{
+    public:
+        typedef typename std::remove_const<T>::type component;
+        typedef T value;
+        static const bool optional = false;
+        static const bool writes = !std::is_const<T>::value;
+
+        template<typename P>
+        static auto get(P p) -> decltype(*p)
+        {
+            return *p;
+        }
+};
+
+template<typename T>
+class ViewArg<Optional<T>>
+{
+    public:
+        typedef typename std::remove_const<T>::type component;
+        typedef T value;
+        static const bool optional = true;
+        static const bool writes = !std::is_const<T>::value;
+
+        template<typename P>
+        static P get(P p)
+        {
+            return p;
+        }
+};
+
+// Components an entity must have to be visited, optional ones excluded
+template<typename... Ts>
+Signature view_signature()
+{
+    const Component ids[] = {(ViewArg<Ts>::optional ? MAX_COMPONENTS : ViewArg<Ts>::component::id)...};
+
+    Signature s;
+    for(auto c : ids)
+    {
+        if(c < MAX_COMPONENTS)
+        {
+            s.set(c);
+        }
+    }
+    return s;
+}
+
+template<typename... Ts>
+Signature components_signature()
+{
+    const Component ids[] = {Ts::id...};
+
+    Signature s;
+    for(auto c : ids)
+    {
+        s.set(c);
+    }
+    return s;
+}
+
+// A query over every entity that has all of Ts and none of the excluded
+// components. each(f) calls f(e, Ts&...) with pointers for Optional<T>.
+// Components stored as structure of arrays arrive as proxies instead, so
+// lambdas taking them should use auto &&.
+// Components that are only read should be asked for as const T, anything
+// else is marked as changed for every entity visited.
+// Iteration is left to the component backend, which knows the fastest way
+// to walk its own storage.
+template<typename Backend, typename... Ts>
+class View
+{
+    public:
+        explicit View(Backend &cm_, ThreadPool *pool_ = nullptr) : cm(cm_), pool(pool_), excluded(), changes(), since(0)
+        {
+        }
+        template<typename... Xs>
+        View& exclude()
+        {
+            excluded |= components_signature<Xs...>();
+            return *this;
+        }
+        // Only entities whose Xs were all written after tick t, e.g. since
+        // a system's last_run. The sparse set backend tracks this per entity,
+        // the archetype backend per chunk, so it may visit a few extra.
+        template<typename... Xs>
+        View& changed(const Tick t)
+        {
+            changes |= components_signature<Xs...>();
+            since = t;
+            return *this;
+        }
+        template<typename F>
+        void each(F f)
+        {
+            cm.template each<Ts...>(excluded, changes, since, f);
+        }
+        // each() split across the manager's thread pool in runs of about
+        // grain entities, falling back to each() for fewer than that or
+        // without a pool. f is called from several threads at once, so it
+        // should only write the components it's handed and record
+        // structural changes in manager->commands. Entities are visited in
+        // no particular order.
+        template<typename F>
+        void parallel_each(F f, const std::size_t grain = ThreadPool::default_grain)
+        {
+            if(pool == nullptr)
+            {
+                each(f);
+                return;
+            }
+            cm.template parallel_each<Ts...>(*pool, grain, excluded, changes, since, f);
+        }
+        const Signature& exclusions() const
+        {
+            return excluded;
+        }
+    private:
+        Backend &cm;
+        ThreadPool *pool;
+        Signature excluded;
+        Signature changes;
+        Tick since;
+};
+
+#endif
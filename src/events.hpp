@@ -0,0 +1,22 @@
+#ifndef EVENTS_HPP
+#define EVENTS_HPP
+
+#include "ecs.hpp"
+
+// a overlapped b this frame and the collision layers let a be hit by b
+// Published by CollisionSystem, b may be dead by the time it's read
+class CollisionEvent : public EventType<CollisionEvent>
+{
+    public:
+        CollisionEvent() : a(invalid_entity), b(invalid_entity)
+        {
+        }
+        CollisionEvent(Entity a, Entity b) : a(a), b(b)
+        {
+        }
+        Entity a;
+        Entity b;
+    private:
+};
+
+#endif
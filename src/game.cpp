@@ -0,0 +1,192 @@
+#include <cmath>
+#include <cstdlib>
+#include "game.hpp"
+#include "components.hpp"
+#include "events.hpp"
+#include "systems.hpp"
+
+void Scenario::scale(const double n)
+{
+    world *= std::sqrt(n);
+    ships = std::lround(ships * n);
+    asteroids = std::lround(asteroids * n);
+    mines = std::lround(mines * n);
+}
+
+std::size_t Scenario::peak_entities() const
+{
+    return 16 * asteroids + 12 * ships + 21 * mines + 64;
+}
+
+std::size_t Scenario::peak_changes() const
+{
+    return peak_entities() / 8 + 64;
+}
+
+bool Scenario::set(const std::string &name, const std::string &value)
+{
+    char *end = nullptr;
+    const double number = std::strtod(value.c_str(), &end);
+    if(value.empty() == true || *end != '\0' || number < 0.0)
+    {
+        return false;
+    }
+
+    if(name == "world" && number > 0.0)
+    {
+        world = number;
+    }
+    else if(name == "ships")
+    {
+        ships = number;
+    }
+    else if(name == "asteroids")
+    {
+        asteroids = number;
+    }
+    else if(name == "mines")
+    {
+        mines = number;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+Game::Game(const Scenario &scenario, Renderer *renderer) : scenario(scenario), manager(), queries(manager, scenario.world), player(invalid_entity)
+{
+    Manager &m = manager;
+
+    // Components have to be created to be used
+    m.create_component<Transform>();
+    m.create_component<Velocity>();
+    m.create_component<Size>();
+    m.create_component<Render>();
+    m.create_component<Inputs>();
+    m.create_component<Weapon>();
+    m.create_component<Timer>();
+    m.create_component<Projectile>();
+    m.create_component<Collision>();
+    m.create_component<Health>();
+    m.create_component<Asteroid>();
+    m.create_component<Rocket>();
+    m.create_component<Trail>();
+    m.create_component<Explode>();
+    m.create_component<Fade>();
+    m.create_component<Player>();
+    m.create_component<AI>();
+    m.create_component<MineAI>();
+    m.create_component<Ship>();
+
+    // Which collision layers can hit which, rocks pass through each other
+    CollisionMatrix layers;
+    layers.collide(ShipLayer, ShipLayer);
+    layers.collide(ShipLayer, ProjectileLayer);
+    layers.collide(ShipLayer, RockLayer);
+    layers.collide(ProjectileLayer, ProjectileLayer);
+    layers.collide(ProjectileLayer, RockLayer);
+
+    // Systems have to be created to run
+    m.create_system<AISystem>(new AISystem(&queries, scenario.world));
+    m.create_system<MineAISystem>(new MineAISystem(&queries));
+    m.create_system<MovementSystem>(new MovementSystem(scenario.world));
+    m.create_system<InputSystem>(new InputSystem());
+    m.create_system<WeaponSystem>(new WeaponSystem());
+    m.create_system<TimerSystem>(new TimerSystem());
+    m.create_system<CollisionSystem>(new CollisionSystem(layers, scenario.world));
+    m.create_system<DamageSystem>(new DamageSystem());
+    m.create_system<HealthSystem>(new HealthSystem());
+    m.create_system<AsteroidSystem>(new AsteroidSystem());
+    m.create_system<RocketSystem>(new RocketSystem());
+    m.create_system<FadeSystem>(new FadeSystem());
+    if(renderer != nullptr)
+    {
+        m.create_system<RenderSystem>(new RenderSystem(renderer, scenario.world));
+    }
+
+    // Systems that don't conflict run at the same time, ECS_THREADS=1 runs
+    // them one after another on this thread
+    m.set_threads(default_threads());
+
+    // Sized for the busiest the scenario gets, so frames don't allocate
+    m.reserve(scenario.peak_entities(), scenario.peak_changes());
+}
+
+void Game::populate()
+{
+    Manager &m = manager;
+    const double world = scenario.world;
+
+    // Add the player
+    player = m.em.get_entity();
+/*
+    if(player != invalid_entity)
+    {
+        m.add_entity_component<Transform>(player, Transform(RAND_BETWEEN(0.25*world, 0.75*world), RAND_BETWEEN(0.25*world, 0.75*world), 0.0));
+        m.add_entity_component<Velocity>(player, Velocity(0.0, RAND_BETWEEN(0, 2 * 3.142)));
+        m.add_entity_component<Size>(player, Size(15.0));
+        m.add_entity_component<Render>(player, Render(1));
+        m.add_entity_component<Inputs>(player, Inputs());
+        m.add_entity_component<Weapon>(player, Weapon());
+        m.add_entity_component<Collision>(player, Collision(ShipLayer));
+        m.add_entity_component<Health>(player, Health(5));
+        m.add_entity_component<Player>(player, Player());
+        m.add_entity_component<Ship>(player, Ship());
+    }
+*/
+    // Add the enemies
+    for(int i = 0; i < scenario.ships; ++i)
+    {
+        Entity e = m.em.get_entity();
+        if(e != invalid_entity)
+        {
+            m.add_entity_component<Transform>(e, Transform(RAND_BETWEEN(0.25*world, 0.75*world), RAND_BETWEEN(0.25*world, 0.75*world), 0.0));
+            m.add_entity_component<Velocity>(e, Velocity(0.0, RAND_BETWEEN(0, 2 * 3.142)));
+            m.add_entity_component<Size>(e, Size(15.0));
+            m.add_entity_component<Render>(e, Render(1));
+            m.add_entity_component<Inputs>(e, Inputs());
+            m.add_entity_component<Weapon>(e, Weapon());
+            m.add_entity_component<Collision>(e, Collision(ShipLayer));
+            m.add_entity_component<Health>(e, Health(5));
+            m.add_entity_component<AI>(e, AI());
+            m.add_entity_component<Ship>(e, Ship());
+        }
+    }
+
+    // Add the asteroids
+    for(int i = 0; i < scenario.asteroids; ++i)
+    {
+        Entity e = m.em.get_entity();
+        if(e != invalid_entity)
+        {
+            float colour = RAND_BETWEEN(100, 200);
+            m.add_entity_component<Transform>(e, Transform(RAND_BETWEEN(0, world), RAND_BETWEEN(0, world), RAND_BETWEEN(0, 2 * 3.142)));
+            m.add_entity_component<Velocity>(e, Velocity(RAND_BETWEEN(50.0, 100.0), RAND_BETWEEN(0, 2 * 3.142)));
+            m.add_entity_component<Size>(e, Size(RAND_BETWEEN(10.0, 15.0)));
+            m.add_entity_component<Render>(e, Render(colour, colour, colour));
+            m.add_entity_component<Collision>(e, Collision(RockLayer));
+            m.add_entity_component<Health>(e, Health(2));
+            m.add_entity_component<Asteroid>(e, Asteroid());
+        }
+    }
+
+    // Add the mines
+    for(int i = 0; i < scenario.mines; ++i)
+    {
+        Entity e = m.em.get_entity();
+        if(e != invalid_entity)
+        {
+            m.add_entity_component<Transform>(e, Transform(RAND_BETWEEN(0, world), RAND_BETWEEN(0, world), RAND_BETWEEN(0, 2 * 3.142)));
+            m.add_entity_component<Velocity>(e, Velocity(0.0, RAND_BETWEEN(0, 2 * 3.142)));
+            m.add_entity_component<Size>(e, Size(3.0));
+            m.add_entity_component<Render>(e, Render(20, 200, 20));
+            m.add_entity_component<Inputs>(e, Inputs());
+            m.add_entity_component<Collision>(e, Collision(RockLayer));
+            m.add_entity_component<Health>(e, Health(1));
+            m.add_entity_component<MineAI>(e, MineAI());
+            m.add_entity_component<Explode>(e, Explode());
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef GAME_HPP
+#define GAME_HPP
+
+#include <string>
+#include "ecs.hpp"
+#include "renderer.hpp"
+#include "spatial_query.hpp"
+
+// How big the world is and what's in it at the start
+// The defaults are the windowed game's.
+class Scenario
+{
+    public:
+        Scenario() : world(512.0), ships(1), asteroids(20), mines(2)
+        {
+        }
+        // n times as much of everything in n times the area, so things are
+        // as far apart as in the default game
+        void scale(const double n);
+        // Sets world, ships, asteroids or mines from text, e.g. ("ships", "100")
+        // Returns false for any other name or a value that isn't a number.
+        bool set(const std::string &name, const std::string &value);
+        // Most entities alive at once, with room to spare
+        // An asteroid breaks into at most 16 rocks, a ship has about 11
+        // shots out and a mine leaves 20 pieces of debris. Sparks only last
+        // half a second, so they fit in the room left by rocks that haven't
+        // broken off yet, and the constant covers a small world's one burst.
+        std::size_t peak_entities() const;
+        // Most entities created, destroyed or given any one component in a
+        // frame, again with room to spare
+        std::size_t peak_changes() const;
+        // Positions wrap at this in both x and y
+        float world;
+        int ships;
+        int asteroids;
+        int mines;
+};
+
+// The asteroids world, shared by the windowed game and the headless driver
+// Creates every component and system the game uses. Without a renderer
+// there's no RenderSystem, so nothing needs a window.
+class Game
+{
+    public:
+        explicit Game(const Scenario &scenario = Scenario(), Renderer *renderer = nullptr);
+        Game(const Game&) = delete;
+        Game& operator=(const Game&) = delete;
+        // The scenario's ships, asteroids and mines, positioned with rand()
+        void populate();
+        void update(const float dt)
+        {
+            manager.update(dt);
+        }
+        const Scenario scenario;
+        Manager manager;
+        // Shared by the AI systems, each index is built once a frame
+        SpatialQueries queries;
+        // Whose Inputs the keyboard and mouse drive
+        Entity player;
+};
+
+#endif
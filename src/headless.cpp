@@ -0,0 +1,466 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+#include "alloc_tracker.hpp"
+#include "broadphase.hpp"
+#include "game.hpp"
+#include "kernels.hpp"
+
+// Runs the game with no window as fast as it will go
+// Any scenario can be run, so this doubles as the stress test that
+// changes to the ECS are measured with.
+//
+// headless [--config file] [--scale n] [--world n] [--ships n] [--asteroids n]
+//          [--mines n] [--frames n] [--seed n] [--report n] [--warmup n]
+//          [--assert-zero-allocs]
+// headless --print-schedule | --check-kernels | --bench-broadphase |
+//          --check-broadphase
+//
+// Built with make PROFILE=1 it also prints how long each system and zone
+// took, and --trace file writes the samples for chrome://tracing. Built
+// with make PERF=1 it prints each system's hardware counters. Built with
+// make ALLOCS=1 it counts heap allocations in each system, and
+// --assert-zero-allocs fails the run if anything allocates once the first
+// --warmup frames are over. make check runs it at several scales and lengths.
+//
+// A config file takes the same settings one per line, e.g. "ships = 100",
+// with # starting a comment. Settings are applied in order, so
+// --scale 100 --world 2048 scales everything and then sets the world size.
+
+typedef std::chrono::steady_clock Clock;
+
+#ifdef ECS_PROFILE
+// Samples kept for --trace, about 60MB
+const std::size_t max_trace_samples = 1 << 20;
+#endif
+
+ECS_ALLOC_HOOKS
+
+struct Settings
+{
+    Settings() : scenario(), frames(6000), seed(1), report(0), warmup(-1)
+    {
+    }
+    Scenario scenario;
+    int frames;
+    unsigned int seed;
+    // Entity counts are printed every this many frames, 0 for 10 times a run
+    int report;
+    // Frames before allocations count as steady state, -1 for half the run
+    int warmup;
+};
+
+bool set(Settings &settings, const std::string &name, const std::string &value)
+{
+    char *end = nullptr;
+    const long number = std::strtol(value.c_str(), &end, 10);
+    const bool whole = value.empty() == false && *end == '\0' && number >= 0;
+
+    if(name == "frames" && whole == true)
+    {
+        settings.frames = number;
+    }
+    else if(name == "seed" && whole == true)
+    {
+        settings.seed = number;
+    }
+    else if(name == "report" && whole == true)
+    {
+        settings.report = number;
+    }
+    else if(name == "warmup" && whole == true)
+    {
+        settings.warmup = number;
+    }
+    else if(name == "scale")
+    {
+        const double n = std::strtod(value.c_str(), &end);
+        if(value.empty() == true || *end != '\0' || n <= 0.0)
+        {
+            return false;
+        }
+        settings.scenario.scale(n);
+    }
+    else
+    {
+        return settings.scenario.set(name, value);
+    }
+    return true;
+}
+
+std::string trim(const std::string &s)
+{
+    const std::size_t first = s.find_first_not_of(" \t\r");
+    if(first == std::string::npos)
+    {
+        return "";
+    }
+    return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+}
+
+bool load(Settings &settings, const char *path)
+{
+    std::ifstream file(path);
+    if(file.is_open() == false)
+    {
+        std::cerr << "Can't open " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for(int number = 1; std::getline(file, line); ++number)
+    {
+        line = trim(line.substr(0, line.find('#')));
+        if(line.empty() == true)
+        {
+            continue;
+        }
+
+        const std::size_t equals = line.find('=');
+        if(equals == std::string::npos || set(settings, trim(line.substr(0, equals)), trim(line.substr(equals + 1))) == false)
+        {
+            std::cerr << path << ":" << number << ": bad setting \"" << line << "\"" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Largest resident set so far in megabytes
+double peak_memory()
+{
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0.0;
+    }
+    // Linux reports kilobytes
+    return usage.ru_maxrss / 1024.0;
+}
+
+#ifdef ECS_PERF_COUNTERS
+// IPC, then each kind of miss per entity the system matched
+void print_counters(const SystemManager &sm)
+{
+    const PerfCounters &counters = PerfCounters::local();
+    if(counters.available() == false)
+    {
+        std::cout << "Hardware counters unavailable: " << counters.reason() << std::endl;
+        return;
+    }
+    if(counters.reason().empty() == false)
+    {
+        std::cout << "Some hardware counters unavailable: " << counters.reason() << std::endl;
+    }
+
+    std::cout << std::left << std::setw(24) << "System" << std::right << std::setw(14) << "Cycles" << std::setw(8) << "IPC";
+    for(int e = L1DMisses; e < NumPerfEvents; ++e)
+    {
+        std::cout << std::setw(22) << (std::string(perf_event_name(e)) + "/entity");
+    }
+    std::cout << std::endl;
+
+    std::cout << std::fixed << std::setprecision(2);
+    for(auto s : sm.get_systems())
+    {
+        const PerfTotals &t = s->perf;
+        const double cycles = t.counts[Cycles];
+        const double entities = t.entities;
+        std::cout << std::left << std::setw(24) << s->name << std::right << std::setw(14) << t.counts[Cycles].load();
+        if(counters.counting(Cycles) == true && counters.counting(Instructions) == true && cycles > 0.0)
+        {
+            std::cout << std::setw(8) << t.counts[Instructions] / cycles;
+        }
+        else
+        {
+            std::cout << std::setw(8) << "-";
+        }
+        for(int e = L1DMisses; e < NumPerfEvents; ++e)
+        {
+            if(counters.counting(e) == true && entities > 0.0)
+            {
+                std::cout << std::setw(22) << t.counts[e] / entities;
+            }
+            else
+            {
+                std::cout << std::setw(22) << "-";
+            }
+        }
+        std::cout << std::endl;
+    }
+    std::cout.unsetf(std::ios::fixed);
+}
+#endif
+
+#ifdef ECS_TRACK_ALLOCS
+// Heap allocations in each frame, split by system
+// Everything is sized up front so watching doesn't allocate itself.
+class AllocWatch
+{
+    public:
+        AllocWatch(const SystemManager &sm, const int warmup) : systems(sm.get_systems()), warmup(warmup), before(systems.size()), worst(systems.size()), total_before(0), bytes_before(0), steady(0), steady_bytes(0), first(0)
+        {
+        }
+        void begin_frame()
+        {
+            for(std::size_t i = 0; i < systems.size(); ++i)
+            {
+                before[i] = systems[i]->allocs.count;
+            }
+            total_before = AllocTracker::all().count;
+            bytes_before = AllocTracker::all().bytes;
+        }
+        void end_frame(const int frame)
+        {
+            for(std::size_t i = 0; i < systems.size(); ++i)
+            {
+                worst[i] = std::max(worst[i], systems[i]->allocs.count - before[i]);
+            }
+            const uint64_t count = AllocTracker::all().count - total_before;
+            if(frame > warmup && count > 0)
+            {
+                steady += count;
+                steady_bytes += AllocTracker::all().bytes - bytes_before;
+                first = first == 0 ? frame : first;
+            }
+        }
+        // Allocations after the warmup
+        uint64_t steady_state() const
+        {
+            return steady;
+        }
+        void print(const int frames) const
+        {
+            std::cout << std::left << std::setw(24) << "System" << std::right << std::setw(14) << "Allocs/frame" << std::setw(14) << "Bytes/frame" << std::setw(14) << "Worst frame" << std::endl;
+            std::cout << std::fixed << std::setprecision(1);
+            uint64_t in_systems = 0;
+            for(std::size_t i = 0; i < systems.size(); ++i)
+            {
+                const AllocTotals &a = systems[i]->allocs;
+                in_systems += a.count;
+                std::cout << std::left << std::setw(24) << systems[i]->name << std::right
+                          << std::setw(14) << a.count / static_cast<double>(frames)
+                          << std::setw(14) << a.bytes / static_cast<double>(frames)
+                          << std::setw(14) << worst[i] << std::endl;
+            }
+            std::cout.unsetf(std::ios::fixed);
+            std::cout << "All allocations: " << AllocTracker::all().count << ", " << AllocTracker::all().count - in_systems << " outside systems" << std::endl;
+            std::cout << "After frame " << warmup << ": " << steady << " allocations, " << steady_bytes << " bytes";
+            if(steady > 0)
+            {
+                std::cout << ", the first in frame " << first;
+            }
+            std::cout << std::endl;
+        }
+    private:
+        const std::vector<System*> &systems;
+        const int warmup;
+        std::vector<uint64_t> before;
+        std::vector<uint64_t> worst;
+        uint64_t total_before;
+        uint64_t bytes_before;
+        uint64_t steady;
+        uint64_t steady_bytes;
+        int first;
+};
+#endif
+
+double seconds(const Clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+int main(int argc, char **argv)
+{
+    // Compare the SIMD kernels against the scalar ones and quit
+    if(argc > 1 && strcmp(argv[1], "--check-kernels") == 0)
+    {
+        std::cout << "Kernels in use: " << simd_level_name(Kernels::get().level) << std::endl;
+        return check_kernels() ? 0 : 1;
+    }
+    // Time the collision broadphases against brute force and quit
+    if(argc > 1 && strcmp(argv[1], "--bench-broadphase") == 0)
+    {
+        return bench_broadphase() ? 0 : 1;
+    }
+    // The same at sizes small enough for make check, failing on any mismatch
+    if(argc > 1 && strcmp(argv[1], "--check-broadphase") == 0)
+    {
+        return bench_broadphase({100, 1000, 5000}) ? 0 : 1;
+    }
+
+    Settings settings;
+    bool print_schedule = false;
+    bool zero_allocs = false;
+#ifdef ECS_PROFILE
+    const char *trace = nullptr;
+#endif
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "--print-schedule") == 0)
+        {
+            print_schedule = true;
+        }
+        else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+#ifdef ECS_PROFILE
+            trace = argv[++i];
+#else
+            std::cerr << "--trace needs a build with make PROFILE=1" << std::endl;
+            return 1;
+#endif
+        }
+        else if(strcmp(argv[i], "--assert-zero-allocs") == 0)
+        {
+            zero_allocs = true;
+#ifndef ECS_TRACK_ALLOCS
+            std::cerr << "--assert-zero-allocs needs a build with make ALLOCS=1" << std::endl;
+            return 1;
+#endif
+        }
+        else if(strcmp(argv[i], "--config") == 0 && i + 1 < argc)
+        {
+            if(load(settings, argv[++i]) == false)
+            {
+                return 1;
+            }
+        }
+        else if(strncmp(argv[i], "--", 2) == 0 && i + 1 < argc)
+        {
+            if(set(settings, argv[i] + 2, argv[i + 1]) == false)
+            {
+                std::cerr << "Bad option: " << argv[i] << " " << argv[i + 1] << std::endl;
+                return 1;
+            }
+            ++i;
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    // The same seed gives the same game, as long as ECS_THREADS=1
+    srand(settings.seed);
+    Game game(settings.scenario);
+
+    // Show which systems run together and quit
+    if(print_schedule == true)
+    {
+        game.manager.sm.print_schedule(std::cout);
+        return 0;
+    }
+
+    const Clock::time_point setup = Clock::now();
+    game.populate();
+
+    const Scenario &scenario = game.scenario;
+    std::cout << "World: " << scenario.world << "x" << scenario.world << std::endl;
+    std::cout << "Ships: " << scenario.ships << " Asteroids: " << scenario.asteroids << " Mines: " << scenario.mines << std::endl;
+    std::cout << "Frames: " << settings.frames << " Seed: " << settings.seed << " Threads: " << game.manager.threads() << std::endl;
+    std::cout << "Setup: " << seconds(Clock::now() - setup) << "s" << std::endl;
+    std::cout << std::endl;
+
+    const int report = settings.report > 0 ? settings.report : std::max(1, settings.frames / 10);
+    std::cout << std::setw(10) << "Frame" << std::setw(12) << "Entities" << std::setw(12) << "Ticks/sec" << std::endl;
+    std::cout << std::setw(10) << 0 << std::setw(12) << game.manager.em.count() << std::setw(12) << "-" << std::endl;
+
+#ifdef ECS_PROFILE
+    if(trace != nullptr)
+    {
+        Profiler::get().keep_samples(max_trace_samples);
+    }
+    Profiler::get().start();
+#endif
+#ifdef ECS_TRACK_ALLOCS
+    AllocWatch allocs(game.manager.sm, settings.warmup >= 0 ? settings.warmup : settings.frames / 2);
+#endif
+    const Clock::time_point start = Clock::now();
+    Clock::time_point last = start;
+    for(int f = 1; f <= settings.frames; ++f)
+    {
+#ifdef ECS_TRACK_ALLOCS
+        allocs.begin_frame();
+        game.update(1.0/60);
+        allocs.end_frame(f);
+#else
+        game.update(1.0/60);
+#endif
+
+        if(f % report == 0 || f == settings.frames)
+        {
+            const Clock::time_point now = Clock::now();
+            const int ticks = f % report == 0 ? report : f % report;
+            std::cout << std::setw(10) << f << std::setw(12) << game.manager.em.count() << std::setw(12) << std::lround(ticks / seconds(now - last)) << std::endl;
+            last = now;
+        }
+    }
+    const double total = seconds(Clock::now() - start);
+
+    std::cout << std::endl;
+    std::cout << "Time: " << total << "s" << std::endl;
+    std::cout << "Ticks/sec: " << (total > 0.0 ? settings.frames / total : 0.0) << std::endl;
+    std::cout << "Peak memory: " << peak_memory() << " MB" << std::endl;
+    std::cout << std::endl;
+
+    // Systems in a parallel stage overlap, so their shares can add up to
+    // more than 100%
+    std::cout << std::left << std::setw(24) << "System" << std::right << std::setw(12) << "Total ms" << std::setw(12) << "us/tick" << std::setw(8) << "Share" << std::endl;
+    for(auto s : game.manager.sm.get_systems())
+    {
+        const double busy = seconds(s->busy);
+        std::cout << std::left << std::setw(24) << s->name << std::right
+                  << std::setw(12) << std::fixed << std::setprecision(1) << busy * 1000.0
+                  << std::setw(12) << (settings.frames > 0 ? busy * 1e6 / settings.frames : 0.0)
+                  << std::setw(7) << (total > 0.0 ? busy * 100.0 / total : 0.0) << "%" << std::endl;
+        std::cout.unsetf(std::ios::fixed);
+    }
+
+#ifdef ECS_PERF_COUNTERS
+    std::cout << std::endl;
+    print_counters(game.manager.sm);
+#endif
+
+#ifdef ECS_TRACK_ALLOCS
+    std::cout << std::endl;
+    allocs.print(settings.frames);
+    if(zero_allocs == true && allocs.steady_state() > 0)
+    {
+        std::cout << "Steady state frames allocated" << std::endl;
+        return 1;
+    }
+#else
+    (void)zero_allocs;
+#endif
+
+#ifdef ECS_PROFILE
+    Profiler &profiler = Profiler::get();
+    profiler.stop();
+    std::cout << std::endl;
+    profiler.print_summary(std::cout);
+    if(profiler.dropped() > 0)
+    {
+        std::cout << "Dropped samples: " << profiler.dropped() << std::endl;
+    }
+    if(trace != nullptr)
+    {
+        std::ofstream file(trace);
+        profiler.write_trace(file);
+        std::cout << "Trace written to " << trace << std::endl;
+        if(profiler.skipped_samples() > 0)
+        {
+            std::cout << "Samples after the first " << max_trace_samples << " left out of the trace: " << profiler.skipped_samples() << std::endl;
+        }
+    }
+#endif
+
+    return 0;
+}
@@ -0,0 +1,456 @@
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Element-wise loops behind MovementSystem, TimerSystem, FadeSystem and
+// HealthSystem, written over plain arrays so they can be vectorised.
+// Every SIMD version has to give bit for bit the same results as the scalar
+// one, check_kernels() compares them. Don't build with FMA contraction
+// (-mfma with -ffp-contract=fast) or the scalar path stops matching.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+enum class SimdLevel
+{
+    Scalar,
+    SSE4,
+    AVX2
+};
+
+inline const char* simd_level_name(const SimdLevel level)
+{
+    switch(level)
+    {
+        case SimdLevel::SSE4: return "sse4.1";
+        case SimdLevel::AVX2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+// x += dt*vx, y += dt*vy, then wrap into [0, bounds]
+inline void movement_scalar(float *x, float *y, const float *vx, const float *vy, const std::size_t n, const float dt, const float bounds)
+{
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        x[i] += dt * vx[i];
+        y[i] += dt * vy[i];
+
+        if(x[i] > bounds) {x[i] -= bounds;}
+        if(x[i] <      0) {x[i] += bounds;}
+
+        if(y[i] > bounds) {y[i] -= bounds;}
+        if(y[i] <      0) {y[i] += bounds;}
+    }
+}
+
+// time_left -= dt, writes the indices that ran out to expired
+// Returns how many were written, expired needs room for n
+inline std::size_t timer_scalar(float *time_left, const std::size_t n, const float dt, uint32_t *expired)
+{
+    std::size_t count = 0;
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        time_left[i] -= dt;
+        if(time_left[i] <= 0.0)
+        {
+            expired[count++] = i;
+        }
+    }
+    return count;
+}
+
+// time += dt, alpha fades from 255 to 0 over fade_time
+inline void fade_scalar(float *time, const float *fade_time, const std::size_t n, const float dt, int *alpha)
+{
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        time[i] += dt;
+
+        if(time[i] < fade_time[i])
+        {
+            alpha[i] = 255*(1.0 - time[i] / fade_time[i]);
+        }
+        else
+        {
+            alpha[i] = 0;
+        }
+    }
+}
+
+// immunity -= dt, clamped at 0
+inline void health_scalar(float *immunity, const std::size_t n, const float dt)
+{
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        immunity[i] -= dt;
+        if(immunity[i] < 0.0)
+        {
+            immunity[i] = 0.0;
+        }
+    }
+}
+
+#ifdef KERNELS_X86
+// Selects rather than adds 0 so -0.0 and friends come out like the scalar code
+__attribute__((target("sse4.1")))
+inline __m128 wrap_sse4(__m128 v, const __m128 bounds)
+{
+    const __m128 zero = _mm_setzero_ps();
+    v = _mm_blendv_ps(v, _mm_sub_ps(v, bounds), _mm_cmpgt_ps(v, bounds));
+    v = _mm_blendv_ps(v, _mm_add_ps(v, bounds), _mm_cmplt_ps(v, zero));
+    return v;
+}
+
+__attribute__((target("sse4.1")))
+inline void movement_sse4(float *x, float *y, const float *vx, const float *vy, const std::size_t n, const float dt, const float bounds)
+{
+    const __m128 step = _mm_set1_ps(dt);
+    const __m128 size = _mm_set1_ps(bounds);
+
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        const __m128 nx = _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(step, _mm_loadu_ps(vx + i)));
+        const __m128 ny = _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(step, _mm_loadu_ps(vy + i)));
+        _mm_storeu_ps(x + i, wrap_sse4(nx, size));
+        _mm_storeu_ps(y + i, wrap_sse4(ny, size));
+    }
+    movement_scalar(x + i, y + i, vx + i, vy + i, n - i, dt, bounds);
+}
+
+__attribute__((target("sse4.1")))
+inline std::size_t timer_sse4(float *time_left, const std::size_t n, const float dt, uint32_t *expired)
+{
+    const __m128 step = _mm_set1_ps(dt);
+    const __m128 zero = _mm_setzero_ps();
+
+    std::size_t count = 0;
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        const __m128 t = _mm_sub_ps(_mm_loadu_ps(time_left + i), step);
+        _mm_storeu_ps(time_left + i, t);
+
+        int mask = _mm_movemask_ps(_mm_cmple_ps(t, zero));
+        while(mask != 0)
+        {
+            expired[count++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    const std::size_t tail = timer_scalar(time_left + i, n - i, dt, expired + count);
+    for(std::size_t j = count; j < count + tail; ++j)
+    {
+        expired[j] += i;
+    }
+    return count + tail;
+}
+
+__attribute__((target("sse4.1")))
+inline void fade_sse4(float *time, const float *fade_time, const std::size_t n, const float dt, int *alpha)
+{
+    const __m128 step = _mm_set1_ps(dt);
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d full = _mm_set1_pd(255.0);
+
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        const __m128 t = _mm_add_ps(_mm_loadu_ps(time + i), step);
+        const __m128 f = _mm_loadu_ps(fade_time + i);
+        _mm_storeu_ps(time + i, t);
+
+        // The scalar code divides in float then finishes in double
+        const __m128 q = _mm_div_ps(t, f);
+        const __m128d lo = _mm_mul_pd(full, _mm_sub_pd(one, _mm_cvtps_pd(q)));
+        const __m128d hi = _mm_mul_pd(full, _mm_sub_pd(one, _mm_cvtps_pd(_mm_movehl_ps(q, q))));
+        const __m128i a = _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+
+        const __m128i fading = _mm_castps_si128(_mm_cmplt_ps(t, f));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(alpha + i), _mm_and_si128(a, fading));
+    }
+    fade_scalar(time + i, fade_time + i, n - i, dt, alpha + i);
+}
+
+__attribute__((target("sse4.1")))
+inline void health_sse4(float *immunity, const std::size_t n, const float dt)
+{
+    const __m128 step = _mm_set1_ps(dt);
+    const __m128 zero = _mm_setzero_ps();
+
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        const __m128 v = _mm_sub_ps(_mm_loadu_ps(immunity + i), step);
+        _mm_storeu_ps(immunity + i, _mm_andnot_ps(_mm_cmplt_ps(v, zero), v));
+    }
+    health_scalar(immunity + i, n - i, dt);
+}
+
+__attribute__((target("avx2")))
+inline __m256 wrap_avx2(__m256 v, const __m256 bounds)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    v = _mm256_blendv_ps(v, _mm256_sub_ps(v, bounds), _mm256_cmp_ps(v, bounds, _CMP_GT_OQ));
+    v = _mm256_blendv_ps(v, _mm256_add_ps(v, bounds), _mm256_cmp_ps(v, zero, _CMP_LT_OQ));
+    return v;
+}
+
+__attribute__((target("avx2")))
+inline void movement_avx2(float *x, float *y, const float *vx, const float *vy, const std::size_t n, const float dt, const float bounds)
+{
+    const __m256 step = _mm256_set1_ps(dt);
+    const __m256 size = _mm256_set1_ps(bounds);
+
+    std::size_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        const __m256 nx = _mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_mul_ps(step, _mm256_loadu_ps(vx + i)));
+        const __m256 ny = _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(step, _mm256_loadu_ps(vy + i)));
+        _mm256_storeu_ps(x + i, wrap_avx2(nx, size));
+        _mm256_storeu_ps(y + i, wrap_avx2(ny, size));
+    }
+    movement_scalar(x + i, y + i, vx + i, vy + i, n - i, dt, bounds);
+}
+
+__attribute__((target("avx2")))
+inline std::size_t timer_avx2(float *time_left, const std::size_t n, const float dt, uint32_t *expired)
+{
+    const __m256 step = _mm256_set1_ps(dt);
+    const __m256 zero = _mm256_setzero_ps();
+
+    std::size_t count = 0;
+    std::size_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        const __m256 t = _mm256_sub_ps(_mm256_loadu_ps(time_left + i), step);
+        _mm256_storeu_ps(time_left + i, t);
+
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(t, zero, _CMP_LE_OQ));
+        while(mask != 0)
+        {
+            expired[count++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    const std::size_t tail = timer_scalar(time_left + i, n - i, dt, expired + count);
+    for(std::size_t j = count; j < count + tail; ++j)
+    {
+        expired[j] += i;
+    }
+    return count + tail;
+}
+
+__attribute__((target("avx2")))
+inline void fade_avx2(float *time, const float *fade_time, const std::size_t n, const float dt, int *alpha)
+{
+    const __m256 step = _mm256_set1_ps(dt);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d full = _mm256_set1_pd(255.0);
+
+    std::size_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        const __m256 t = _mm256_add_ps(_mm256_loadu_ps(time + i), step);
+        const __m256 f = _mm256_loadu_ps(fade_time + i);
+        _mm256_storeu_ps(time + i, t);
+
+        // The scalar code divides in float then finishes in double
+        const __m256 q = _mm256_div_ps(t, f);
+        const __m256d lo = _mm256_mul_pd(full, _mm256_sub_pd(one, _mm256_cvtps_pd(_mm256_castps256_ps128(q))));
+        const __m256d hi = _mm256_mul_pd(full, _mm256_sub_pd(one, _mm256_cvtps_pd(_mm256_extractf128_ps(q, 1))));
+        const __m256i a = _mm256_insertf128_si256(_mm256_castsi128_si256(_mm256_cvttpd_epi32(lo)), _mm256_cvttpd_epi32(hi), 1);
+
+        const __m256i fading = _mm256_castps_si256(_mm256_cmp_ps(t, f, _CMP_LT_OQ));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(alpha + i), _mm256_and_si256(a, fading));
+    }
+    fade_scalar(time + i, fade_time + i, n - i, dt, alpha + i);
+}
+
+__attribute__((target("avx2")))
+inline void health_avx2(float *immunity, const std::size_t n, const float dt)
+{
+    const __m256 step = _mm256_set1_ps(dt);
+    const __m256 zero = _mm256_setzero_ps();
+
+    std::size_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        const __m256 v = _mm256_sub_ps(_mm256_loadu_ps(immunity + i), step);
+        _mm256_storeu_ps(immunity + i, _mm256_andnot_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), v));
+    }
+    health_scalar(immunity + i, n - i, dt);
+}
+#endif
+
+// One set of kernels, picked for the CPU we're running on
+class Kernels
+{
+    public:
+        typedef void (*MovementFn)(float*, float*, const float*, const float*, std::size_t, float, float);
+        typedef std::size_t (*TimerFn)(float*, std::size_t, float, uint32_t*);
+        typedef void (*FadeFn)(float*, const float*, std::size_t, float, int*);
+        typedef void (*HealthFn)(float*, std::size_t, float);
+
+        static Kernels build(const SimdLevel level)
+        {
+            Kernels k = {SimdLevel::Scalar, movement_scalar, timer_scalar, fade_scalar, health_scalar};
+#ifdef KERNELS_X86
+            if(level == SimdLevel::SSE4)
+            {
+                k = {level, movement_sse4, timer_sse4, fade_sse4, health_sse4};
+            }
+            else if(level == SimdLevel::AVX2)
+            {
+                k = {level, movement_avx2, timer_avx2, fade_avx2, health_avx2};
+            }
+#endif
+            return k;
+        }
+        static bool supported(const SimdLevel level)
+        {
+#ifdef KERNELS_X86
+            switch(level)
+            {
+                case SimdLevel::SSE4: return __builtin_cpu_supports("sse4.1");
+                case SimdLevel::AVX2: return __builtin_cpu_supports("avx2");
+                default: return true;
+            }
+#else
+            return level == SimdLevel::Scalar;
+#endif
+        }
+        static SimdLevel best()
+        {
+            if(supported(SimdLevel::AVX2)) {return SimdLevel::AVX2;}
+            if(supported(SimdLevel::SSE4)) {return SimdLevel::SSE4;}
+            return SimdLevel::Scalar;
+        }
+        // Chosen once, ECS_SIMD=scalar|sse4.1|avx2 overrides the detection
+        static const Kernels& get()
+        {
+            static const Kernels k = build(choose());
+            return k;
+        }
+        SimdLevel level;
+        MovementFn movement;
+        TimerFn timer;
+        FadeFn fade;
+        HealthFn health;
+    private:
+        static SimdLevel choose()
+        {
+            const char *env = std::getenv("ECS_SIMD");
+            if(env != nullptr)
+            {
+                for(auto level : {SimdLevel::Scalar, SimdLevel::SSE4, SimdLevel::AVX2})
+                {
+                    if(std::strcmp(env, simd_level_name(level)) == 0 && supported(level))
+                    {
+                        return level;
+                    }
+                }
+            }
+            return best();
+        }
+};
+
+// Runs every supported SIMD level against the scalar kernels on the same
+// inputs, edge cases included, and reports any result that isn't bit exact
+inline bool check_kernels()
+{
+    const std::size_t n = 1027;
+    const float dt = 1.0/60.0;
+    const float special[] = {0.0f, -0.0f, 512.0f, 512.0001f, -0.0001f, 1e-8f, -1e-8f, dt, -dt, 3.0f};
+
+    std::vector<float> x(n), y(n), vx(n), vy(n), t(n), f(n);
+    srand(1);
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        const bool edge = i % 7 == 0;
+        x[i] = edge ? special[i % 10] : (float)rand()/RAND_MAX * 520.0f - 4.0f;
+        y[i] = edge ? special[(i/7) % 10] : (float)rand()/RAND_MAX * 520.0f - 4.0f;
+        vx[i] = (float)rand()/RAND_MAX * 600.0f - 300.0f;
+        vy[i] = (float)rand()/RAND_MAX * 600.0f - 300.0f;
+        t[i] = edge ? special[i % 10] : (float)rand()/RAND_MAX * 3.0f - 0.5f;
+        f[i] = edge && i % 2 == 0 ? t[i] + dt : (float)rand()/RAND_MAX * 2.0f + 0.01f;
+    }
+
+    const Kernels scalar = Kernels::build(SimdLevel::Scalar);
+    bool ok = true;
+
+    for(auto level : {SimdLevel::SSE4, SimdLevel::AVX2})
+    {
+        if(Kernels::supported(level) == false)
+        {
+            std::cout << simd_level_name(level) << ": not supported" << std::endl;
+            continue;
+        }
+        const Kernels k = Kernels::build(level);
+
+        // Every length up to a few blocks, then the lot
+        std::vector<std::size_t> lengths;
+        for(std::size_t len = 0; len <= 40; ++len)
+        {
+            lengths.push_back(len);
+        }
+        lengths.push_back(n);
+
+        for(auto len : lengths)
+        {
+            auto ax = x, ay = y, bx = x, by = y;
+            scalar.movement(ax.data(), ay.data(), vx.data(), vy.data(), len, dt, 512.0);
+            k.movement(bx.data(), by.data(), vx.data(), vy.data(), len, dt, 512.0);
+            const bool movement_ok = std::memcmp(ax.data(), bx.data(), n * sizeof(float)) == 0 &&
+                                     std::memcmp(ay.data(), by.data(), n * sizeof(float)) == 0;
+
+            auto at = t, bt = t;
+            std::vector<uint32_t> ae(n), be(n);
+            const std::size_t ac = scalar.timer(at.data(), len, dt, ae.data());
+            const std::size_t bc = k.timer(bt.data(), len, dt, be.data());
+            const bool timer_ok = ac == bc &&
+                                  std::memcmp(at.data(), bt.data(), n * sizeof(float)) == 0 &&
+                                  std::memcmp(ae.data(), be.data(), ac * sizeof(uint32_t)) == 0;
+
+            auto afade = t, bfade = t;
+            std::vector<int> aa(n), ba(n);
+            scalar.fade(afade.data(), f.data(), len, dt, aa.data());
+            k.fade(bfade.data(), f.data(), len, dt, ba.data());
+            const bool fade_ok = std::memcmp(afade.data(), bfade.data(), n * sizeof(float)) == 0 &&
+                                 std::memcmp(aa.data(), ba.data(), n * sizeof(int)) == 0;
+
+            auto ah = t, bh = t;
+            scalar.health(ah.data(), len, dt);
+            k.health(bh.data(), len, dt);
+            const bool health_ok = std::memcmp(ah.data(), bh.data(), n * sizeof(float)) == 0;
+
+            if(movement_ok == false || timer_ok == false || fade_ok == false || health_ok == false)
+            {
+                std::cout << simd_level_name(level) << ": mismatch at length " << len
+                          << (movement_ok ? "" : " movement")
+                          << (timer_ok ? "" : " timer")
+                          << (fade_ok ? "" : " fade")
+                          << (health_ok ? "" : " health") << std::endl;
+                ok = false;
+                break;
+            }
+        }
+
+        if(ok == true)
+        {
+            std::cout << simd_level_name(level) << ": ok" << std::endl;
+        }
+    }
+
+    return ok;
+}
+
+#endif
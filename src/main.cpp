@@ -1,15 +1,14 @@
 #include <iostream>
-#include "ecs.hpp"
 #include "components.hpp"
-#include "systems.hpp"
+#include "game.hpp"
+#include "sdl_renderer.hpp"
 #include <SDL.h>
 #include <SDL_opengl.h>
 #include <SDL_image.h>
+#include <cstring>
 #include <ctime>
 
-#define RAND_BETWEEN(a, b) ((double)rand()/RAND_MAX * (b-a) + a)
-
-int main()
+int main(int argc, char **argv)
 {
     srand(time(0));
     SDL_Init(SDL_INIT_EVERYTHING);
@@ -33,115 +32,22 @@ int main()
     SDL_Texture* ship_texture = SDL_CreateTextureFromSurface(renderer, loaded_surface);
     SDL_FreeSurface(loaded_surface);
 
-    auto m = Manager();
-
-    // Components have to be created to be used
-    m.create_component<Transform>();
-    m.create_component<Velocity>();
-    m.create_component<Size>();
-    m.create_component<Render>();
-    m.create_component<Inputs>();
-    m.create_component<Weapon>();
-    m.create_component<Timer>();
-    m.create_component<Projectile>();
-    m.create_component<Collision>();
-    m.create_component<Health>();
-    m.create_component<Asteroid>();
-    m.create_component<Rocket>();
-    m.create_component<Trail>();
-    m.create_component<Explode>();
-    m.create_component<Fade>();
-    m.create_component<Player>();
-    m.create_component<AI>();
-    m.create_component<MineAI>();
-    m.create_component<Ship>();
-
-    // Systems have to be created to run
-    auto input_system = new InputSystem();
-    m.create_system<AISystem>(new AISystem());
-    m.create_system<MineAISystem>(new MineAISystem());
-    m.create_system<MovementSystem>(new MovementSystem());
-    m.create_system<InputSystem>(input_system);
-    m.create_system<WeaponSystem>(new WeaponSystem());
-    m.create_system<TimerSystem>(new TimerSystem());
-    m.create_system<CollisionSystem>(new CollisionSystem());
-    m.create_system<DamageSystem>(new DamageSystem());
-    m.create_system<HealthSystem>(new HealthSystem());
-    m.create_system<AsteroidSystem>(new AsteroidSystem());
-    m.create_system<RocketSystem>(new RocketSystem());
-    m.create_system<FadeSystem>(new FadeSystem());
-    m.create_system<RenderSystem>(new RenderSystem(renderer, ship_texture));
-
-    // Add the player
-    Entity player_entity = m.em.get_entity();
-/*
-    if(player_entity != invalid_entity)
-    {
-        m.add_entity_component<Transform>(player_entity, Transform(RAND_BETWEEN(0.25*512, 0.75*512), RAND_BETWEEN(0.25*512, 0.75*512), 0.0));
-        m.add_entity_component<Velocity>(player_entity, Velocity(0.0, RAND_BETWEEN(0, 2 * 3.142)));
-        m.add_entity_component<Size>(player_entity, Size(15.0));
-        m.add_entity_component<Render>(player_entity, Render(1));
-        m.add_entity_component<Inputs>(player_entity, Inputs());
-        m.add_entity_component<Weapon>(player_entity, Weapon());
-        m.add_entity_component<Collision>(player_entity, Collision(1, true));
-        m.add_entity_component<Health>(player_entity, Health(5));
-        m.add_entity_component<Player>(player_entity, Player());
-        m.add_entity_component<Ship>(player_entity, Ship());
-    }
-*/
-    // Add en enemy
-    for(int i = 0; i < 1; ++i)
-    {
-        Entity e = m.em.get_entity();
-        if(e != invalid_entity)
-        {
-            m.add_entity_component<Transform>(e, Transform(RAND_BETWEEN(0.25*512, 0.75*512), RAND_BETWEEN(0.25*512, 0.75*512), 0.0));
-            m.add_entity_component<Velocity>(e, Velocity(0.0, RAND_BETWEEN(0, 2 * 3.142)));
-            m.add_entity_component<Size>(e, Size(15.0));
-            m.add_entity_component<Render>(e, Render(1));
-            m.add_entity_component<Inputs>(e, Inputs());
-            m.add_entity_component<Weapon>(e, Weapon());
-            m.add_entity_component<Collision>(e, Collision(1, true));
-            m.add_entity_component<Health>(e, Health(5));
-            m.add_entity_component<AI>(e, AI());
-            m.add_entity_component<Ship>(e, Ship());
-        }
-    }
+    SDLRenderer draw(renderer, ship_texture);
+    Game game(Scenario(), &draw);
+    Manager &m = game.manager;
 
-    // Add the asteroids
-    for(int i = 0; i < 20; ++i)
+    // Show which systems run together and quit
+    if(argc > 1 && strcmp(argv[1], "--print-schedule") == 0)
     {
-        Entity e = m.em.get_entity();
-        if(e != invalid_entity)
-        {
-            float colour = RAND_BETWEEN(100, 200);
-            m.add_entity_component<Transform>(e, Transform(RAND_BETWEEN(0, 512), RAND_BETWEEN(0, 512), RAND_BETWEEN(0, 2 * 3.142)));
-            m.add_entity_component<Velocity>(e, Velocity(RAND_BETWEEN(50.0, 100.0), RAND_BETWEEN(0, 2 * 3.142)));
-            m.add_entity_component<Size>(e, Size(RAND_BETWEEN(10.0, 15.0)));
-            m.add_entity_component<Render>(e, Render(colour, colour, colour));
-            m.add_entity_component<Collision>(e, Collision(3, false));
-            m.add_entity_component<Health>(e, Health(2));
-            m.add_entity_component<Asteroid>(e, Asteroid());
-        }
+        m.sm.print_schedule(std::cout);
+        SDL_DestroyTexture(ship_texture);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return 0;
     }
 
-    // Add the mines
-    for(int i = 0; i < 2; ++i)
-    {
-        Entity e = m.em.get_entity();
-        if(e != invalid_entity)
-        {
-            m.add_entity_component<Transform>(e, Transform(RAND_BETWEEN(0, 512), RAND_BETWEEN(0, 512), RAND_BETWEEN(0, 2 * 3.142)));
-            m.add_entity_component<Velocity>(e, Velocity(0.0, RAND_BETWEEN(0, 2 * 3.142)));
-            m.add_entity_component<Size>(e, Size(3.0));
-            m.add_entity_component<Render>(e, Render(20, 200, 20));
-            m.add_entity_component<Inputs>(e, Inputs());
-            m.add_entity_component<Collision>(e, Collision(3, false));
-            m.add_entity_component<Health>(e, Health(1));
-            m.add_entity_component<MineAI>(e, MineAI());
-            m.add_entity_component<Explode>(e, Explode());
-        }
-    }
+    game.populate();
+    const Entity player_entity = game.player;
 
     // User inputs
     bool left = false;
@@ -262,7 +168,7 @@ int main()
             a->selected = selected;
         }
 
-        m.update(1.0/60);
+        game.update(1.0/60);
 
         SDL_GL_SwapWindow(window);
 
@@ -0,0 +1,15 @@
+#ifndef RENDERER_HPP
+#define RENDERER_HPP
+
+// What RenderSystem draws with, so the game itself doesn't need a window
+// Positions are in pixels from the top left of the screen.
+class Renderer
+{
+    public:
+        virtual ~Renderer() = default;
+        virtual void fill_rect(const int x, const int y, const int w, const int h, const int red, const int green, const int blue, const int alpha) = 0;
+        // The ship texture turned by degrees clockwise about its centre
+        virtual void draw_ship(const int x, const int y, const int w, const int h, const double degrees) = 0;
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef SDL_RENDERER_HPP
+#define SDL_RENDERER_HPP
+
+#include <SDL.h>
+#include "renderer.hpp"
+
+class SDLRenderer : public Renderer
+{
+    public:
+        SDLRenderer(SDL_Renderer *r, SDL_Texture *ship_texture) : renderer(r), ship_texture(ship_texture)
+        {
+        }
+        void fill_rect(const int x, const int y, const int w, const int h, const int red, const int green, const int blue, const int alpha)
+        {
+            SDL_Rect rect = {x, y, w, h};
+            SDL_SetRenderDrawColor(renderer, red, green, blue, alpha);
+            SDL_RenderFillRect(renderer, &rect);
+        }
+        void draw_ship(const int x, const int y, const int w, const int h, const double degrees)
+        {
+            SDL_Rect rect = {x, y, w, h};
+            SDL_Point center = {w / 2, h / 2};
+            SDL_RenderCopyEx(renderer, ship_texture, nullptr, &rect, degrees, &center, SDL_FLIP_NONE);
+        }
+    private:
+        SDL_Renderer *renderer;
+        SDL_Texture *ship_texture;
+};
+
+#endif
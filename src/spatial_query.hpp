@@ -0,0 +1,337 @@
+#ifndef SPATIAL_QUERY_HPP
+#define SPATIAL_QUERY_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "components.hpp"
+#include "ecs.hpp"
+
+// One result of a query
+// dx and dy point from the query position to the entity the short way
+// round the world, so they can be used as they are without wrapping.
+struct Neighbour
+{
+    Entity entity;
+    float dx;
+    float dy;
+    float dist2;
+};
+
+inline bool operator<(const Neighbour &a, const Neighbour &b)
+{
+    return a.dist2 < b.dist2;
+}
+
+// Points in a square world that wraps at its edges, bucketed in a grid
+// Built in one go with a count pass and a fill pass into flat arrays that
+// are reused between builds. Nearest queries search rings of cells
+// outwards from the query and stop once no closer point can be left.
+// Queries don't change the index, so once it's built any number of
+// threads can query it at once.
+class SpatialIndex
+{
+    public:
+        static const int max_dims = 64;
+
+        explicit SpatialIndex(const float world_) : world(world_), dims(1), cell(world_), starts({}), points({}), sorted({}), cells({}), fill({})
+        {
+            // The grid grows with the points, reserved so that doesn't allocate
+            starts.reserve(max_dims * max_dims + 1);
+            fill.reserve(max_dims * max_dims);
+        }
+        void clear()
+        {
+            points.clear();
+        }
+        void reserve(const std::size_t n)
+        {
+            points.reserve(n);
+            sorted.reserve(n);
+            cells.reserve(n);
+        }
+        void insert(const Entity e, const float x, const float y)
+        {
+            points.push_back(Point{e, wrap_position(x), wrap_position(y)});
+        }
+        // Call once every point has been inserted, before any queries
+        void build()
+        {
+            const std::size_t n = points.size();
+            const int most = max_dims;
+            dims = std::max(1, std::min(most, static_cast<int>(std::sqrt(n / 2.0))));
+            cell = world / dims;
+
+            cells.resize(n);
+            starts.assign(dims * dims + 1, 0);
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                cells[i] = cell_of(points[i].x, points[i].y);
+                starts[cells[i] + 1]++;
+            }
+            for(int c = 0; c < dims * dims; ++c)
+            {
+                starts[c + 1] += starts[c];
+            }
+
+            // Sorted by cell so each cell's points are contiguous
+            sorted.resize(n);
+            fill.assign(starts.begin(), starts.end() - 1);
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                sorted[fill[cells[i]]++] = points[i];
+            }
+        }
+        std::size_t size() const
+        {
+            return points.size();
+        }
+        // entity is invalid_entity if there's nothing but skip
+        Neighbour nearest(const float x, const float y, const Entity skip = invalid_entity) const
+        {
+            std::vector<Neighbour> &heap = scratch();
+            search(x, y, 1, skip, heap);
+            if(heap.empty() == true)
+            {
+                return Neighbour{invalid_entity, 0.0f, 0.0f, std::numeric_limits<float>::infinity()};
+            }
+            return heap.front();
+        }
+        // Up to k closest, nearest first
+        void nearest(const float x, const float y, const std::size_t k, std::vector<Neighbour> &out, const Entity skip = invalid_entity) const
+        {
+            std::vector<Neighbour> &heap = scratch();
+            search(x, y, k, skip, heap);
+            std::sort_heap(heap.begin(), heap.end());
+            out.assign(heap.begin(), heap.end());
+        }
+        // Everything within radius, in no particular order
+        void within(const float x, const float y, const float radius, std::vector<Neighbour> &out) const
+        {
+            out.clear();
+            const float qx = wrap_position(x);
+            const float qy = wrap_position(y);
+            const float r2 = radius * radius;
+            const int rings = std::min(static_cast<int>(std::ceil(radius / cell)), dims);
+            for(int r = 0; r <= rings; ++r)
+            {
+                each_ring_cell(qx, qy, r, [&](const int c)
+                {
+                    for(uint32_t i = starts[c]; i < starts[c + 1]; ++i)
+                    {
+                        const Neighbour n = offset(qx, qy, sorted[i]);
+                        if(n.dist2 <= r2)
+                        {
+                            out.push_back(n);
+                        }
+                    }
+                });
+            }
+        }
+    private:
+        struct Point
+        {
+            Entity entity;
+            float x;
+            float y;
+        };
+        float wrap_position(const float v) const
+        {
+            const float w = std::fmod(v, world);
+            return w < 0.0f ? w + world : w;
+        }
+        int wrap_cell(const int i) const
+        {
+            const int m = i % dims;
+            return m < 0 ? m + dims : m;
+        }
+        uint32_t cell_of(const float x, const float y) const
+        {
+            const int cx = std::min(dims - 1, static_cast<int>(x / cell));
+            const int cy = std::min(dims - 1, static_cast<int>(y / cell));
+            return cy * dims + cx;
+        }
+        // Shortest displacement on the torus
+        float shortest(float d) const
+        {
+            if(d > world / 2)
+            {
+                d -= world;
+            }
+            else if(d < -world / 2)
+            {
+                d += world;
+            }
+            return d;
+        }
+        Neighbour offset(const float qx, const float qy, const Point &p) const
+        {
+            const float dx = shortest(p.x - qx);
+            const float dy = shortest(p.y - qy);
+            return Neighbour{p.entity, dx, dy, dx*dx + dy*dy};
+        }
+        // Calls f(c) for each cell r cells away from the query's cell
+        // Offsets are limited to one lap of the grid so no cell comes up twice
+        template<typename F>
+        void each_ring_cell(const float qx, const float qy, const int r, F f) const
+        {
+            const int lo = -(dims - 1) / 2;
+            const int hi = dims / 2;
+            const int cx = static_cast<int>(cell_of(qx, qy)) % dims;
+            const int cy = static_cast<int>(cell_of(qx, qy)) / dims;
+
+            for(int oy = -r; oy <= r; ++oy)
+            {
+                if(oy < lo || oy > hi)
+                {
+                    continue;
+                }
+                const bool edge = oy == -r || oy == r;
+                for(int ox = -r; ox <= r; ox += (edge ? 1 : 2 * r))
+                {
+                    if(ox >= lo && ox <= hi)
+                    {
+                        f(wrap_cell(cy + oy) * dims + wrap_cell(cx + ox));
+                    }
+                    if(r == 0)
+                    {
+                        break;
+                    }
+                }
+            }
+        }
+        // Per thread so queries can run in parallel
+        static std::vector<Neighbour>& scratch()
+        {
+            static thread_local std::vector<Neighbour> heap;
+            heap.clear();
+            return heap;
+        }
+        // Keeps the k best in a max heap on dist2
+        // Points in ring r+1 and beyond are at least r cells away, so once
+        // the heap is full and its worst is within that the search is done.
+        void search(const float x, const float y, const std::size_t k, const Entity skip, std::vector<Neighbour> &heap) const
+        {
+            if(k == 0 || points.empty() == true)
+            {
+                return;
+            }
+
+            const float qx = wrap_position(x);
+            const float qy = wrap_position(y);
+            const int last = dims / 2;
+            for(int r = 0; r <= last; ++r)
+            {
+                each_ring_cell(qx, qy, r, [&](const int c)
+                {
+                    for(uint32_t i = starts[c]; i < starts[c + 1]; ++i)
+                    {
+                        if(sorted[i].entity == skip)
+                        {
+                            continue;
+                        }
+                        const Neighbour n = offset(qx, qy, sorted[i]);
+                        if(heap.size() < k)
+                        {
+                            heap.push_back(n);
+                            std::push_heap(heap.begin(), heap.end());
+                        }
+                        else if(n.dist2 < heap.front().dist2)
+                        {
+                            std::pop_heap(heap.begin(), heap.end());
+                            heap.back() = n;
+                            std::push_heap(heap.begin(), heap.end());
+                        }
+                    }
+                });
+
+                const float reach = r * cell;
+                if(heap.size() == k && heap.front().dist2 <= reach * reach)
+                {
+                    return;
+                }
+            }
+        }
+        float world;
+        int dims;
+        float cell;
+        std::vector<uint32_t> starts;
+        std::vector<Point> points;
+        std::vector<Point> sorted;
+        std::vector<uint32_t> cells;
+        std::vector<uint32_t> fill;
+};
+
+// Spatial indices of every entity with a tag component, shared by systems
+// Each index is built from Transform the first time it's asked for in a
+// frame, so any number of systems can query it for the cost of one build.
+// Building isn't thread safe, so call index<Tag>() before querying from
+// inside a parallel_each().
+//
+// auto hit = queries->nearest<Asteroid>(x, y);
+class SpatialQueries
+{
+    public:
+        SpatialQueries(Manager &manager_, const float world_) : manager(manager_), world(world_), indices(), built()
+        {
+        }
+        template<typename Tag>
+        SpatialIndex& index()
+        {
+            auto &index = find<Tag>();
+            if(built[Tag::id] != manager.frame() + 1)
+            {
+                index->clear();
+                manager.view<const Tag, const Transform>().each([&index](Entity e, const Tag&, auto &&t)
+                {
+                    index->insert(e, t.x, t.y);
+                });
+                index->build();
+                built[Tag::id] = manager.frame() + 1;
+            }
+            return *index;
+        }
+        // Room for n entities in Tag's index
+        template<typename Tag>
+        void reserve(const std::size_t n)
+        {
+            find<Tag>()->reserve(n);
+        }
+        template<typename Tag>
+        Neighbour nearest(const float x, const float y, const Entity skip = invalid_entity)
+        {
+            return index<Tag>().nearest(x, y, skip);
+        }
+        template<typename Tag>
+        void nearest(const float x, const float y, const std::size_t k, std::vector<Neighbour> &out, const Entity skip = invalid_entity)
+        {
+            index<Tag>().nearest(x, y, k, out, skip);
+        }
+        template<typename Tag>
+        void within(const float x, const float y, const float radius, std::vector<Neighbour> &out)
+        {
+            index<Tag>().within(x, y, radius, out);
+        }
+    private:
+        template<typename Tag>
+        std::unique_ptr<SpatialIndex>& find()
+        {
+            auto &index = indices[Tag::id];
+            if(index == nullptr)
+            {
+                index.reset(new SpatialIndex(world));
+            }
+            return index;
+        }
+        Manager &manager;
+        float world;
+        std::array<std::unique_ptr<SpatialIndex>, MAX_COMPONENTS> indices;
+        // Frame each index was built on plus one, zero for never
+        std::array<std::size_t, MAX_COMPONENTS> built;
+};
+
+#endif
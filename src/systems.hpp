@@ -1,102 +1,110 @@
 #ifndef SYSTEMS_HPP
 #define SYSTEMS_HPP
 
+#include "broadphase.hpp"
 #include "ecs.hpp"
-#include <SDL.h>
+#include "kernels.hpp"
+#include "renderer.hpp"
+#include "spatial_query.hpp"
+
+// Shared by systems besides components and events, see Access
+enum GameResource
+{
+    // rand(), kept to one system at a time so a seed replays the same game
+    RandomResource,
+    // SpatialQueries, which builds its indices on first use each frame
+    SpatialResource
+};
 
 class MovementSystem : public System
 {
     public:
-        MovementSystem()
+        explicit MovementSystem(const float world) : world(world)
         {
-            required.insert(Transform::id);
-            required.insert(Velocity::id);
+            required.set(Transform::id);
+            required.set(Velocity::id);
+            // Packing moves velocities around too
+            access.write<Transform, Velocity>();
         }
         void update(const float dt)
         {
             assert(manager != nullptr);
 
-            auto &transform_store = manager->cm.get_store<Transform>();
-            auto &velocity_store = manager->cm.get_store<Velocity>();
-
-            for(auto e : entities)
+#ifdef ECS_ARCHETYPES
+            manager->view<Transform, Velocity>().parallel_each([this, dt](Entity, auto &&transform, auto &&velocity)
             {
-                assert(manager->cm.entity_has_component(e, Transform::id));
-                assert(manager->cm.entity_has_component(e, Velocity::id));
-
-                auto transform = transform_store.get_component(e);
-                auto velocity = velocity_store.get_component(e);
-
-                transform->x += dt * velocity->x;
-                transform->y += dt * velocity->y;
-
-                if(transform->x > 512) {transform->x -= 512;}
-                if(transform->x <   0) {transform->x += 512;}
-
-                if(transform->y > 512) {transform->y -= 512;}
-                if(transform->y <   0) {transform->y += 512;}
+                movement_scalar(&transform.x, &transform.y, &velocity.x, &velocity.y, 1, dt, world);
+            });
+#else
+            // Slot i of both stores is the same entity for i < n
+            const std::size_t n = manager->cm.pack<Transform, Velocity>();
+            auto &transforms = manager->cm.get_store<Transform>().columns;
+            auto &velocities = manager->cm.get_store<Velocity>().columns;
+
+            const auto move = [&](const std::size_t begin, const std::size_t end)
+            {
+                Kernels::get().movement(transforms.x.data() + begin, transforms.y.data() + begin, velocities.x.data() + begin, velocities.y.data() + begin, end - begin, dt, world);
+            };
+            if(manager->thread_pool() != nullptr)
+            {
+                manager->thread_pool()->parallel_for(n, ThreadPool::default_grain, move);
             }
+            else
+            {
+                move(0, n);
+            }
+            manager->cm.get_store<Transform>().mark(0, n);
+#endif
         }
     private:
+        // Positions wrap at this in both x and y
+        float world;
 };
 
 class RenderSystem : public System
 {
     public:
-        RenderSystem(SDL_Renderer *r, SDL_Texture *ship_texture) : renderer(r), ship_texture(ship_texture)
+        RenderSystem(Renderer *r, const float world_) : renderer(r), world(world_)
         {
-            required.insert(Transform::id);
-            required.insert(Render::id);
-            required.insert(Size::id);
+            required.set(Transform::id);
+            required.set(Render::id);
+            required.set(Size::id);
+            access.read<Transform, Render, Size>();
+            // Most graphics libraries want drawing done on the thread that
+            // made the window
+            pinned = true;
         }
         void update(const float dt)
         {
             assert(manager != nullptr);
             assert(renderer != nullptr);
-            assert(ship_texture != nullptr);
-
-            auto &transform_store = manager->cm.get_store<Transform>();
-            auto &size_store = manager->cm.get_store<Size>();
-            auto &render_store = manager->cm.get_store<Render>();
 
-            for(auto e : entities)
+            manager->view<const Transform, const Size, const Render>().each([this](Entity, auto &&a, const Size &b, const Render &c)
             {
-                assert(manager->cm.entity_has_component(e, Transform::id));
-                assert(manager->cm.entity_has_component(e, Render::id));
-                assert(manager->cm.entity_has_component(e, Size::id));
-
-                auto a = transform_store.get_component(e);
-                auto b = size_store.get_component(e);
-                auto c = render_store.get_component(e);
-
-                SDL_SetRenderDrawColor(renderer, c->red, c->green, c->blue, c->alpha);
-
                 for(int x = -1; x < 2; ++x)
                 {
                     for(int y = -1; y < 2; ++y)
                     {
-                        SDL_Rect rect;
-                        rect.x = a->x - b->radius + x*512;
-                        rect.y = 512 - a->y - b->radius + y*512;
-                        rect.w = 2 * b->radius;
-                        rect.h = 2 * b->radius;
+                        const int left = a.x - b.radius + x*world;
+                        const int top = world - a.y - b.radius + y*world;
+                        const int width = 2 * b.radius;
 
-                        if(c->texture == 1)
+                        if(c.texture == 1)
                         {
-                            SDL_Point center = {(int)b->radius, (int)b->radius};
-                            SDL_RenderCopyEx(renderer, ship_texture, nullptr, &rect, -a->rotation*180/3.142 + 90, &center, SDL_FLIP_NONE);
+                            renderer->draw_ship(left, top, width, width, -a.rotation*180/3.142 + 90);
                         }
                         else
                         {
-                            SDL_RenderFillRect(renderer, &rect);
+                            renderer->fill_rect(left, top, width, width, c.red, c.green, c.blue, c.alpha);
                         }
                     }
                 }
-            }
+            });
         }
     private:
-        SDL_Renderer *renderer;
-        SDL_Texture *ship_texture;
+        Renderer *renderer;
+        // Positions wrap at this in both x and y, and y counts up from the bottom
+        float world;
 };
 
 class InputSystem : public System
@@ -104,43 +112,33 @@ class InputSystem : public System
     public:
         InputSystem()
         {
-            required.insert(Transform::id);
-            required.insert(Velocity::id);
-            required.insert(Inputs::id);
+            required.set(Transform::id);
+            required.set(Velocity::id);
+            required.set(Inputs::id);
+            access.read<Inputs>();
+            access.write<Transform, Velocity>();
         }
         void update(const float dt)
         {
             assert(manager != nullptr);
 
-            auto &transform_store = manager->cm.get_store<Transform>();
-            auto &velocity_store = manager->cm.get_store<Velocity>();
-            auto &inputs_store   = manager->cm.get_store<Inputs>();
-
-            for(auto e : entities)
+            manager->view<Transform, Velocity, const Inputs>().each([](Entity, auto &&transform, auto &&velocity, const Inputs &inputs)
             {
-                assert(manager->cm.entity_has_component(e, Transform::id));
-                assert(manager->cm.entity_has_component(e, Velocity::id));
-                assert(manager->cm.entity_has_component(e, Inputs::id));
-
-                auto transform = transform_store.get_component(e);
-                auto inputs = inputs_store.get_component(e);
-                auto velocity = velocity_store.get_component(e);
-
-                float dx = inputs->mouse_x - transform->x;
-                float dy = inputs->mouse_y - transform->y;
-                transform->rotation = atan2(dy, dx);
+                float dx = inputs.mouse_x - transform.x;
+                float dy = inputs.mouse_y - transform.y;
+                transform.rotation = atan2(dy, dx);
 
-                if(inputs->left == true)       {velocity->x -= 5;}
-                else if(inputs->right == true) {velocity->x += 5;}
-                if(inputs->up == true)         {velocity->y += 5;}
-                else if(inputs->down == true)  {velocity->y -= 5;}
+                if(inputs.left == true)       {velocity.x -= 5;}
+                else if(inputs.right == true) {velocity.x += 5;}
+                if(inputs.up == true)         {velocity.y += 5;}
+                else if(inputs.down == true)  {velocity.y -= 5;}
 
                 const float speed_limit = 100.0;
-                if(velocity->x > speed_limit)       {velocity->x =  speed_limit;}
-                else if(velocity->x < -speed_limit) {velocity->x = -speed_limit;}
-                if(velocity->y > speed_limit)       {velocity->y =  speed_limit;}
-                else if(velocity->y < -speed_limit) {velocity->y = -speed_limit;}
-            }
+                if(velocity.x > speed_limit)       {velocity.x =  speed_limit;}
+                else if(velocity.x < -speed_limit) {velocity.x = -speed_limit;}
+                if(velocity.y > speed_limit)       {velocity.y =  speed_limit;}
+                else if(velocity.y < -speed_limit) {velocity.y = -speed_limit;}
+            });
         }
     private:
 };
@@ -150,154 +148,180 @@ class WeaponSystem : public System
     public:
         WeaponSystem()
         {
-            required.insert(Weapon::id);
-            required.insert(Inputs::id);
-            required.insert(Transform::id);
+            required.set(Weapon::id);
+            required.set(Inputs::id);
+            required.set(Transform::id);
+            access.read<Inputs, Transform>();
+            access.write<Weapon>();
+            access.create_entities();
+        }
+        // Bullets and rockets
+        void reserve(const std::size_t)
+        {
+            manager->prepare<Transform, Velocity, Render, Size, Timer, Projectile, Collision, Health>();
+            manager->prepare<Transform, Velocity, Render, Size, Timer, Rocket, Collision, Health, Explode>();
         }
+        // Shots are recorded in each thread's own command buffer
         void update(const float dt)
         {
             assert(manager != nullptr);
 
-            auto &inputs_store = manager->cm.get_store<Inputs>();
-            auto &transform_store = manager->cm.get_store<Transform>();
-            auto &weapon_store = manager->cm.get_store<Weapon>();
-
-            for(auto e : entities)
+            manager->view<Weapon, const Inputs, const Transform>().parallel_each([this, dt](Entity e, Weapon &b, const Inputs &a, auto &&t)
             {
-                assert(manager->cm.entity_has_component(e, Weapon::id));
-                assert(manager->cm.entity_has_component(e, Inputs::id));
-                assert(manager->cm.entity_has_component(e, Transform::id));
-
-                auto a = inputs_store.get_component(e);
-                auto b = weapon_store.get_component(e);
-
-                b->time_left -= dt;
+                b.time_left -= dt;
 
-                if(b->time_left < 0.0)
+                if(b.time_left < 0.0)
                 {
-                    b->time_left = 0.0;
+                    b.time_left = 0.0;
                 }
 
-                if(a->use == true && b->time_left <= 0.0)
+                if(a.use == true && b.time_left <= 0.0)
                 {
-                    b->time_left = 0.1;
+                    b.time_left = 0.1;
 
-                    Entity new_entity = manager->em.get_entity();
-                    if(new_entity != invalid_entity)
-                    {
-                        auto transform = transform_store.get_component(e);
+                    const Transform transform = t;
 
-                        float x = transform->x + 25.0*cos(transform->rotation);
-                        float y = transform->y + 25.0*sin(transform->rotation);
+                    float x = transform.x + 25.0*cos(transform.rotation);
+                    float y = transform.y + 25.0*sin(transform.rotation);
 
-                        if(a->selected == 0)
-                        {
-                            // Bullet
-                            manager->add_entity_component<Transform>(new_entity, Transform(x, y, transform->rotation));
-                            manager->add_entity_component<Velocity>(new_entity, Velocity(200.0, transform->rotation));
-                            manager->add_entity_component<Render>(new_entity, Render(0,255,0));
-                            manager->add_entity_component<Size>(new_entity, Size(1.0));
-                            manager->add_entity_component<Timer>(new_entity, Timer(1.0));
-                            manager->add_entity_component<Projectile>(new_entity, Projectile(e, 1));
-                            manager->add_entity_component<Collision>(new_entity, Collision(2, true));
-                            manager->add_entity_component<Health>(new_entity, Health());
-                        }
-                        else if(a->selected == 1)
-                        {
-                            // Rocket
-                            manager->add_entity_component<Transform>(new_entity, Transform(x, y, transform->rotation));
-                            manager->add_entity_component<Velocity>(new_entity, Velocity(50.0, transform->rotation));
-                            manager->add_entity_component<Render>(new_entity, Render(255,0,0));
-                            manager->add_entity_component<Size>(new_entity, Size(2.0));
-                            manager->add_entity_component<Timer>(new_entity, Timer(2.0));
-                            manager->add_entity_component<Rocket>(new_entity, Rocket(e, 2, 0.5));
-                            manager->add_entity_component<Collision>(new_entity, Collision(2, true));
-                            manager->add_entity_component<Health>(new_entity, Health());
-                            manager->add_entity_component<Explode>(new_entity, Explode());
-                        }
+                    if(a.selected == 0)
+                    {
+                        // Bullet
+                        manager->commands.create(Transform(x, y, transform.rotation),
+                                                 Velocity(200.0, transform.rotation),
+                                                 Render(0,255,0),
+                                                 Size(1.0),
+                                                 Timer(1.0),
+                                                 Projectile(e, 1),
+                                                 Collision(ProjectileLayer),
+                                                 Health());
+                    }
+                    else if(a.selected == 1)
+                    {
+                        // Rocket
+                        manager->commands.create(Transform(x, y, transform.rotation),
+                                                 Velocity(50.0, transform.rotation),
+                                                 Render(255,0,0),
+                                                 Size(2.0),
+                                                 Timer(2.0),
+                                                 Rocket(e, 2, 0.5),
+                                                 Collision(ProjectileLayer),
+                                                 Health(),
+                                                 Explode());
                     }
                 }
-            }
+            });
         }
     private:
 };
 
+// One of the four colours used by rocket smoke and explosions
+inline Render flame_colour(const int n)
+{
+    if(n == 0)
+    {
+        return Render(220, 20, 20);
+    }
+    else if(n == 1)
+    {
+        return Render(220, 200, 20);
+    }
+    else if(n == 2)
+    {
+        return Render(220, 70, 20);
+    }
+    return Render(50, 20, 20);
+}
+
 class RocketSystem : public System
 {
     public:
         RocketSystem()
         {
-            required.insert(Rocket::id);
-            required.insert(Transform::id);
-            required.insert(Velocity::id);
+            required.set(Rocket::id);
+            required.set(Transform::id);
+            required.set(Velocity::id);
+            access.read<Transform>();
+            access.write<Rocket>();
+            access.write_resource(RandomResource);
+            access.create_entities();
+        }
+        // Rockets boost when they're given a Trail and smoke until they die
+        void init()
+        {
+            manager->observers.on_add<Trail>([this](const std::vector<Entity> &es)
+            {
+                for(auto e : es)
+                {
+                    auto v = manager->get_entity_component<Velocity>(e);
+                    if(v != nullptr)
+                    {
+                        v->x *= 5;
+                        v->y *= 5;
+                    }
+                    trailing.push_back(e);
+                }
+            });
+            manager->observers.on_remove<Trail>([this](const std::vector<Entity> &es)
+            {
+                trailing.erase(std::remove_if(trailing.begin(), trailing.end(), [&es](const Entity e)
+                {
+                    return std::find(es.begin(), es.end(), e) != es.end();
+                }), trailing.end());
+            });
+        }
+        void reserve(const std::size_t n)
+        {
+            manager->prepare(smoke);
+            trailing.reserve(n);
         }
         void update(const float dt)
         {
             assert(manager != nullptr);
 
-            auto &rocket_store = manager->cm.get_store<Rocket>();
-            auto &transform_store = manager->cm.get_store<Transform>();
-            auto &velocity_store = manager->cm.get_store<Velocity>();
-
-            for(auto e : entities)
+            manager->view<Rocket>().each([this, dt](Entity e, Rocket &r)
             {
-                assert(manager->cm.entity_has_component(e, Rocket::id));
-                assert(manager->cm.entity_has_component(e, Transform::id));
-                assert(manager->cm.entity_has_component(e, Velocity::id));
-
-                auto r = rocket_store.get_component(e);
+                r.boost_time_left -= dt;
 
-                r->boost_time_left -= dt;
-
-                if(r->boost_time_left <= 0.0 && r->boost_time_left + dt > 0.0)
+                if(r.boost_time_left <= 0.0 && r.boost_time_left + dt > 0.0)
                 {
-                    auto v = velocity_store.get_component(e);
-                    v->x *= 5;
-                    v->y *= 5;
-                    manager->add_entity_component<Trail>(e, Trail());
+                    manager->commands.add(e, Trail());
                 }
+            });
 
-                if(manager->cm.entity_has_component(e, Trail::id))
+            for(auto e : trailing)
+            {
+                if(rand()%2 != 0)
                 {
-                    if(rand()%2 == 0)
-                    {
-                        Entity new_entity = manager->em.get_entity();
-                        if(new_entity != invalid_entity)
-                        {
-                            auto transform = transform_store.get_component(e);
+                    continue;
+                }
 
-                            manager->add_entity_component<Transform>(new_entity, Transform(
-                                transform->x + RAND_BETWEEN(-3.0, 3.0),
-                                transform->y + RAND_BETWEEN(-3.0, 3.0),
-                                RAND_BETWEEN(0, 2 * 3.142))
-                            );
-                            manager->add_entity_component<Size>(new_entity, Size(1.0));
-                            int n = rand()%4;
-                            if(n == 0)
-                            {
-                                manager->add_entity_component<Render>(new_entity, Render(220, 20, 20));
-                            }
-                            else if(n == 1)
-                            {
-                                manager->add_entity_component<Render>(new_entity, Render(220, 200, 20));
-                            }
-                            else if(n == 2)
-                            {
-                                manager->add_entity_component<Render>(new_entity, Render(220, 70, 20));
-                            }
-                            else
-                            {
-                                manager->add_entity_component<Render>(new_entity, Render(50, 20, 20));
-                            }
-                            float time = RAND_BETWEEN(0.5, 0.75);
-                            manager->add_entity_component<Timer>(new_entity, Timer(time));
-                            manager->add_entity_component<Fade>(new_entity, Fade(time));
-                        }
-                    }
+                auto transform = manager->read_entity_component<Transform>(e);
+                if(transform == nullptr)
+                {
+                    continue;
                 }
+                const float x = transform->x;
+                const float y = transform->y;
+
+                manager->commands.create_batch(smoke, 1, [x, y](std::size_t, Transform &puff, Size&, Render &render, Timer &timer, Fade &fade)
+                {
+                    puff = Transform(
+                        x + RAND_BETWEEN(-3.0, 3.0),
+                        y + RAND_BETWEEN(-3.0, 3.0),
+                        RAND_BETWEEN(0, 2 * 3.142)
+                    );
+                    render = flame_colour(rand()%4);
+                    float time = RAND_BETWEEN(0.5, 0.75);
+                    timer = Timer(time);
+                    fade = Fade(time);
+                });
             }
         }
     private:
+        const Prefab<Transform, Size, Render, Timer, Fade> smoke{Transform(), Size(1.0), Render(), Timer(), Fade()};
+        // Entities with a Trail, kept up to date by the observers
+        std::vector<Entity> trailing;
 };
 
 class TimerSystem : public System
@@ -305,86 +329,163 @@ class TimerSystem : public System
     public:
         TimerSystem()
         {
-            required.insert(Timer::id);
+            required.set(Timer::id);
+            access.write<Timer>();
+        }
+        void reserve(const std::size_t n)
+        {
+            expired.reserve(n);
         }
         void update(const float dt)
         {
             assert(manager != nullptr);
 
-            auto &timer_store = manager->cm.get_store<Timer>();
-
-            for(auto e : entities)
+#ifdef ECS_ARCHETYPES
+            manager->view<Timer>().each([this, dt](Entity e, Timer &a)
             {
-                assert(manager->cm.entity_has_component(e, Timer::id));
-
-                auto a = timer_store.get_component(e);
+                a.time_left -= dt;
 
-                a->time_left -= dt;
-
-                if(a->time_left <= 0.0)
+                if(a.time_left <= 0.0)
                 {
-                    manager->remove.push_back(e);
+                    manager->commands.destroy(e);
                 }
+            });
+#else
+            auto &store = manager->cm.get_store<Timer>();
+            expired.resize(store.size());
+
+            const std::size_t count = Kernels::get().timer(store.columns.time_left.data(), store.size(), dt, expired.data());
+            store.mark(0, store.size());
+
+            // Backwards, the same order a view would have found them in
+            for(std::size_t i = count; i-- > 0;)
+            {
+                manager->commands.destroy(store.entities[expired[i]]);
             }
+#endif
         }
     private:
+        std::vector<uint32_t> expired;
 };
 
 class CollisionSystem : public System
 {
     public:
-        CollisionSystem()
+        CollisionSystem(const CollisionMatrix &layers, const float world, const Broadphase broadphase = Broadphase::SweepAndPrune) : layers(layers), broadphase(broadphase), hash(world), sap(world)
         {
-            required.insert(Collision::id);
-            required.insert(Transform::id);
-            required.insert(Size::id);
+            required.set(Collision::id);
+            required.set(Transform::id);
+            required.set(Size::id);
+            access.read<Collision, Transform, Size>();
+            access.write<CollisionEvent>();
+        }
+        // A pair for every collider is far more than the game ever sees
+        void reserve(const std::size_t n)
+        {
+            colliders.reserve(n);
+            pairs.reserve(n);
+            hash.reserve(n);
+            sap.reserve(n);
+            manager->events.queue<CollisionEvent>().reserve(2 * n);
         }
         void update(const float dt)
         {
             assert(manager != nullptr);
 
-            auto &collision_store = manager->cm.get_store<Collision>();
-            auto &transform_store = manager->cm.get_store<Transform>();
-            auto &size_store = manager->cm.get_store<Size>();
-
-            for(auto e : entities)
             {
-                assert(manager->cm.entity_has_component(e, Collision::id));
-                assert(manager->cm.entity_has_component(e, Transform::id));
-                assert(manager->cm.entity_has_component(e, Size::id));
-
-                auto c = collision_store.get_component(e);
-                auto a = transform_store.get_component(e);
-                auto r = size_store.get_component(e);
-
-                c->collided = false;
-
-                for(auto e2 : entities)
+                ECS_ZONE("gather colliders");
+                colliders.clear();
+                manager->view<const Collision, const Transform, const Size>().each([this](Entity e, const Collision &c, auto &&a, const Size &r)
                 {
-                    if(e == e2) {continue;} // FIXME: Try e <= e2
-
-                    auto c2 = collision_store.get_component(e2);
-
-                    // FIXME: Test this
-                    if(c->mask == c2->mask && c->self == false) {continue;}
-                    //if((c->mask & c2->mask) == 0) {continue;}
+                    colliders.push_back(Collider{e, c.layer, a.x, a.y, r.radius});
+                });
+            }
 
-                    auto a2 = transform_store.get_component(e2);
-                    auto r2 = size_store.get_component(e2);
+            // Pairs on layers that can't hit each other are never generated
+            if(broadphase == Broadphase::Grid)
+            {
+                ECS_ZONE("grid");
+                hash.build(colliders);
+                hash.pairs(colliders, layers, pairs);
+            }
+            else
+            {
+                ECS_ZONE("sweep and prune");
+                sap.build(colliders);
+                sweep();
+            }
 
-                    float dx = a->x - a2->x;
-                    float dy = a->y - a2->y;
-                    float dist = r->radius + r2->radius;
+            // A pair only means one of them can hit the other, so check both
+            ECS_ZONE("publish collisions");
+            for(auto &pair : pairs)
+            {
+                auto &first = colliders[pair.a];
+                auto &second = colliders[pair.b];
 
-                    if(fabs(dx) <= dist && fabs(dy) <= dist)
-                    {
-                        c->collided = true;
-                        break;
-                    }
+                if(layers.allows(first.layer, second.layer) == true)
+                {
+                    manager->events.publish(CollisionEvent(first.entity, second.entity));
+                }
+                if(layers.allows(second.layer, first.layer) == true)
+                {
+                    manager->events.publish(CollisionEvent(second.entity, first.entity));
                 }
             }
         }
     private:
+        // The sweep is split into ranges of colliders that find their pairs
+        // on separate threads, then joined in order so the pairs come out
+        // the same however many threads there are
+        void sweep()
+        {
+            ThreadPool *pool = manager->thread_pool();
+            const std::size_t n = sap.size();
+            if(pool == nullptr || n <= ThreadPool::default_grain)
+            {
+                sap.pairs(colliders, layers, pairs);
+                return;
+            }
+
+            // At most four ranges a thread, each list kept with room for
+            // every pair
+            const std::size_t grain = (n + 4 * pool->size() - 1) / (4 * pool->size());
+            if(found.size() < 4 * pool->size())
+            {
+                found.resize(4 * pool->size());
+                for(auto &out : found)
+                {
+                    out.reserve(pairs.capacity());
+                }
+            }
+            pool->parallel_for(n, grain, [this, grain](const std::size_t begin, const std::size_t end)
+            {
+                auto &out = found[begin / grain];
+                out.clear();
+                sap.pairs(colliders, layers, out, begin, end);
+            });
+
+            pairs.clear();
+            for(std::size_t i = 0; i * grain < n; ++i)
+            {
+                pairs.insert(pairs.end(), found[i].begin(), found[i].end());
+            }
+        }
+        // Position and size are copied, Transform may be split into arrays
+        struct Collider
+        {
+            Entity entity;
+            uint8_t layer;
+            float x;
+            float y;
+            float radius;
+        };
+        CollisionMatrix layers;
+        Broadphase broadphase;
+        std::vector<Collider> colliders;
+        std::vector<ColliderPair> pairs;
+        SpatialHash hash;
+        SweepAndPrune sap;
+        std::vector<std::vector<ColliderPair>> found;
 };
 
 class HealthSystem : public System
@@ -392,26 +493,23 @@ class HealthSystem : public System
     public:
         HealthSystem()
         {
-            required.insert(Health::id);
+            required.set(Health::id);
+            access.write<Health>();
         }
         void update(const float dt)
         {
             assert(manager != nullptr);
 
-            auto &health_store = manager->cm.get_store<Health>();
-
-            for(auto e : entities)
+#ifdef ECS_ARCHETYPES
+            manager->view<Health>().each([dt](Entity, Health &h)
             {
-                assert(manager->cm.entity_has_component(e, Health::id));
-
-                auto h = health_store.get_component(e);
-
-                h->immunity -= dt;
-                if(h->immunity < 0.0)
-                {
-                    h->immunity = 0.0;
-                }
-            }
+                health_scalar(&h.immunity, 1, dt);
+            });
+#else
+            auto &store = manager->cm.get_store<Health>();
+            Kernels::get().health(store.columns.immunity.data(), store.size(), dt);
+            store.mark(0, store.size());
+#endif
         }
     private:
 };
@@ -421,79 +519,69 @@ class DamageSystem : public System
     public:
         DamageSystem()
         {
-            required.insert(Health::id);
-            required.insert(Collision::id);
-            required.insert(Transform::id);
+            required.set(Health::id);
+            required.set(Collision::id);
+            required.set(Transform::id);
+            access.read<CollisionEvent, Transform, Explode>();
+            access.write<Health>();
+            access.write_resource(RandomResource);
+            access.read_entities();
+            access.create_entities();
+        }
+        void reserve(const std::size_t)
+        {
+            manager->prepare(debris);
         }
         void update(const float dt)
         {
             assert(manager != nullptr);
 
-            auto &collision_store = manager->cm.get_store<Collision>();
-            auto &health_store = manager->cm.get_store<Health>();
-            auto &transform_store = manager->cm.get_store<Transform>();
-
-            for(auto e : entities)
+            // Only entities that were hit last frame, an entity hit several
+            // times is immune after the first
+            for(auto &event : manager->events.read<CollisionEvent>())
             {
-                assert(manager->cm.entity_has_component(e, Collision::id));
-                assert(manager->cm.entity_has_component(e, Health::id));
-                assert(manager->cm.entity_has_component(e, Transform::id));
+                const Entity e = event.a;
+                if(manager->em.alive(e) == false)
+                {
+                    continue;
+                }
+
+                auto h = manager->get_entity_component<Health>(e);
+                auto t = manager->read_entity_component<Transform>(e);
+                if(h == nullptr || t == nullptr || h->immunity > 0.0)
+                {
+                    continue;
+                }
 
-                auto c = collision_store.get_component(e);
-                auto h = health_store.get_component(e);
+                h->health--;
+                h->immunity = 0.1;
 
-                if(c->collided == true && h->immunity <= 0.0)
+                if(h->health <= 0)
                 {
-                    h->health--;
-                    h->immunity = 0.1;
+                    manager->commands.destroy(e);
 
-                    if(h->health <= 0)
+                    if(manager->read_entity_component<Explode>(e) != nullptr)
                     {
-                        manager->remove.push_back(e);
+                        const Transform transform = *t;
 
-                        if(manager->cm.entity_has_component(e, Explode::id))
+                        manager->commands.create_batch(debris, 20, [&transform](std::size_t, Transform &particle, Size&, Render &render, Timer &timer, Fade &fade)
                         {
-                            for(int i = 0; i < 20; ++i)
-                            {
-                                Entity new_entity = manager->em.get_entity();
-                                if(new_entity != invalid_entity)
-                                {
-                                    auto transform = transform_store.get_component(e);
-
-                                    manager->add_entity_component<Transform>(new_entity, Transform(
-                                        transform->x + RAND_BETWEEN(-4.0, 4.0)*RAND_BETWEEN(-4.0, 4.0),
-                                        transform->y + RAND_BETWEEN(-4.0, 4.0)*RAND_BETWEEN(-4.0, 4.0),
-                                        RAND_BETWEEN(0, 2 * 3.142))
-                                    );
-                                    manager->add_entity_component<Size>(new_entity, Size(5.0));
-                                    int n = rand()%4;
-                                    if(n == 0)
-                                    {
-                                        manager->add_entity_component<Render>(new_entity, Render(220, 20, 20));
-                                    }
-                                    else if(n == 1)
-                                    {
-                                        manager->add_entity_component<Render>(new_entity, Render(220, 200, 20));
-                                    }
-                                    else if(n == 2)
-                                    {
-                                        manager->add_entity_component<Render>(new_entity, Render(220, 70, 20));
-                                    }
-                                    else
-                                    {
-                                        manager->add_entity_component<Render>(new_entity, Render(50, 20, 20));
-                                    }
-                                    float time = RAND_BETWEEN(0.1, 1.0);
-                                    manager->add_entity_component<Timer>(new_entity, Timer(time));
-                                    manager->add_entity_component<Fade>(new_entity, Fade(time));
-                                }
-                            }
-                        }
+                            particle = Transform(
+                                transform.x + RAND_BETWEEN(-4.0, 4.0)*RAND_BETWEEN(-4.0, 4.0),
+                                transform.y + RAND_BETWEEN(-4.0, 4.0)*RAND_BETWEEN(-4.0, 4.0),
+                                RAND_BETWEEN(0, 2 * 3.142)
+                            );
+                            render = flame_colour(rand()%4);
+                            float time = RAND_BETWEEN(0.1, 1.0);
+                            timer = Timer(time);
+                            fade = Fade(time);
+                        });
                     }
                 }
             }
         }
     private:
+        const Prefab<Transform, Size, Render, Timer, Fade> debris{Transform(), Size(5.0), Render(), Timer(), Fade()};
 };
 
 class AsteroidSystem : public System
@@ -501,74 +589,63 @@ class AsteroidSystem : public System
     public:
         AsteroidSystem()
         {
-            required.insert(Transform::id);
-            required.insert(Size::id);
-            required.insert(Health::id);
-            required.insert(Asteroid::id);
+            required.set(Transform::id);
+            required.set(Size::id);
+            required.set(Health::id);
+            required.set(Asteroid::id);
+            access.read<Transform, Size, Health, Asteroid>();
+            access.write_resource(RandomResource);
+            access.create_entities();
+        }
+        void reserve(const std::size_t)
+        {
+            manager->prepare(rock);
+            manager->prepare(sparks);
         }
         void update(const float dt)
         {
             assert(manager != nullptr);
 
-            auto &transform_store = manager->cm.get_store<Transform>();
-            auto &size_store = manager->cm.get_store<Size>();
-            auto &health_store = manager->cm.get_store<Health>();
-
-            for(auto e : entities)
+            manager->view<const Transform, const Size, const Health, const Asteroid>().each([this](Entity, auto &&t, const Size &s, auto &&h, const Asteroid&)
             {
-                assert(manager->cm.entity_has_component(e, Transform::id));
-                assert(manager->cm.entity_has_component(e, Size::id));
-                assert(manager->cm.entity_has_component(e, Health::id));
-
-                auto health = health_store.get_component(e);
-                auto size = size_store.get_component(e);
+                const Health health = h;
+                const Size size = s;
 
-                if(health->health <= 0 && size->radius >= 6.0)
+                if(health.health <= 0 && size.radius >= 6.0)
                 {
-                    auto transform = transform_store.get_component(e);
+                    const Transform transform = t;
 
                     // New asteroids
-                    for(int i = 0; i < rand()%2+3; ++i)
+                    manager->commands.create_batch(rock, rand()%2+3, [&](std::size_t, Transform &rock_transform, Velocity &rock_velocity, Size &rock_size, Render &render, Collision&, Health &rock_health, Asteroid&)
                     {
-                        Entity new_entity = manager->em.get_entity();
-                        if(new_entity != invalid_entity)
-                        {
-                            int colour = RAND_BETWEEN(100, 200);
-                            manager->add_entity_component<Transform>(new_entity, Transform(transform->x, transform->y, RAND_BETWEEN(0, 2 * 3.142)));
-                            manager->add_entity_component<Velocity>(new_entity, Velocity(RAND_BETWEEN(50.0, 100.0), RAND_BETWEEN(0, 2 * 3.142)));
-                            manager->add_entity_component<Size>(new_entity, Size(size->radius/2));
-                            manager->add_entity_component<Render>(new_entity, Render(colour, colour, colour));
-                            manager->add_entity_component<Collision>(new_entity, Collision(3, false));
-                            manager->add_entity_component<Health>(new_entity, Health(health->start_health - 1));
-                            manager->add_entity_component<Asteroid>(new_entity, Asteroid());
-                        }
-                    }
+                        int colour = RAND_BETWEEN(100, 200);
+                        rock_transform = Transform(transform.x, transform.y, RAND_BETWEEN(0, 2 * 3.142));
+                        rock_velocity = Velocity(RAND_BETWEEN(50.0, 100.0), RAND_BETWEEN(0, 2 * 3.142));
+                        rock_size = Size(size.radius/2);
+                        render = Render(colour, colour, colour);
+                        rock_health = Health(health.start_health - 1);
+                    });
 
                     // Pretty particles
-                    for(int i = 0; i < rand()%5+20; ++i)
+                    manager->commands.create_batch(sparks, rand()%5+20, [&transform](std::size_t, Transform &spark, Velocity &spark_velocity, Size&, Render &render, Timer&, Fade&)
                     {
-                        Entity new_entity = manager->em.get_entity();
-                        if(new_entity != invalid_entity)
+                        spark = Transform(transform.x, transform.y, RAND_BETWEEN(0, 2 * 3.142));
+                        spark_velocity = Velocity(RAND_BETWEEN(150.0, 300.0), RAND_BETWEEN(0, 2 * 3.142));
+                        if(rand()%2 == 0)
                         {
-                            manager->add_entity_component<Transform>(new_entity, Transform(transform->x, transform->y, RAND_BETWEEN(0, 2 * 3.142)));
-                            manager->add_entity_component<Velocity>(new_entity, Velocity(RAND_BETWEEN(150.0, 300.0), RAND_BETWEEN(0, 2 * 3.142)));
-                            manager->add_entity_component<Size>(new_entity, Size(1.0));
-                            if(rand()%2 == 0)
-                            {
-                                manager->add_entity_component<Render>(new_entity, Render(220, 20, 20));
-                            }
-                            else
-                            {
-                                manager->add_entity_component<Render>(new_entity, Render(220, 140, 20));
-                            }
-                            manager->add_entity_component<Timer>(new_entity, Timer(0.5));
-                            manager->add_entity_component<Fade>(new_entity, Fade(0.5));
+                            render = Render(220, 20, 20);
                         }
-                    }
+                        else
+                        {
+                            render = Render(220, 140, 20);
+                        }
+                    });
                 }
-            }
+            });
         }
     private:
+        const Prefab<Transform, Velocity, Size, Render, Collision, Health, Asteroid> rock{Transform(), Velocity(), Size(), Render(), Collision(RockLayer), Health(), Asteroid()};
+        const Prefab<Transform, Velocity, Size, Render, Timer, Fade> sparks{Transform(), Velocity(), Size(1.0), Render(), Timer(0.5), Fade(0.5)};
 };
 
 class FadeSystem : public System
@@ -576,135 +653,132 @@ class FadeSystem : public System
     public:
         FadeSystem()
         {
-            required.insert(Fade::id);
+            required.set(Fade::id);
+            required.set(Render::id);
+            access.write<Fade, Render>();
+        }
+        void reserve(const std::size_t n)
+        {
+            alphas.reserve(n);
         }
         void update(const float dt)
         {
             assert(manager != nullptr);
 
-            auto &fade_store = manager->cm.get_store<Fade>();
-            auto &render_store = manager->cm.get_store<Render>();
-
-            for(auto e : entities)
+#ifdef ECS_ARCHETYPES
+            manager->view<Fade, Render>().each([dt](Entity, Fade &fade, Render &render)
             {
-                assert(manager->cm.entity_has_component(e, Fade::id));
-
-                auto fade = fade_store.get_component(e);
-                auto render = render_store.get_component(e);
-
-                fade->time += dt;
-
-                if(fade->time < fade->fade_time)
-                {
-                    render->alpha = 255*(1.0 - fade->time / fade->fade_time);
-                }
-                else
-                {
-                    render->alpha = 0;
-                }
+                fade_scalar(&fade.time, &fade.fade_time, 1, dt, &render.alpha);
+            });
+#else
+            // Slot i of both stores is the same entity for i < n
+            const std::size_t n = manager->cm.pack<Fade, Render>();
+            auto &fades = manager->cm.get_store<Fade>().columns;
+            auto &renders = manager->cm.get_store<Render>().components;
+
+            alphas.resize(n);
+            Kernels::get().fade(fades.time.data(), fades.fade_time.data(), n, dt, alphas.data());
+
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                renders[i].alpha = alphas[i];
             }
+            manager->cm.get_store<Fade>().mark(0, n);
+            manager->cm.get_store<Render>().mark(0, n);
+#endif
         }
     private:
+        std::vector<int> alphas;
 };
 
 class AISystem : public System
 {
     public:
-        AISystem()
+        AISystem(SpatialQueries *q, const float world) : queries(q), world(world)
         {
-            required.insert(AI::id);
-            required.insert(Inputs::id);
-            required.insert(Transform::id);
+            required.set(AI::id);
+            required.set(Inputs::id);
+            required.set(Transform::id);
+            required.set(Velocity::id);
+            access.read<Transform, Velocity, Player, Asteroid>();
+            access.write<AI, Inputs>();
+            access.write_resource(SpatialResource);
+            access.create_entities();
         }
+        // Aim markers too
+        void reserve(const std::size_t n)
+        {
+            queries->reserve<Player>(n);
+            queries->reserve<Asteroid>(n);
+            manager->prepare<Transform, Size, Render, Timer>();
+        }
+        // Each ship searches for its target on whichever thread it lands on
         void update(const float dt)
         {
             assert(manager != nullptr);
 
-            auto &ai_store = manager->cm.get_store<AI>();
-            auto &inputs_store = manager->cm.get_store<Inputs>();
-            auto &transform_store = manager->cm.get_store<Transform>();
             auto &velocity_store = manager->cm.get_store<Velocity>();
 
-            auto players = manager->cm.components[Player::id];
-            auto asteroids = manager->cm.components[Asteroid::id];
+            // Built here, they can't be built from several threads at once
+            {
+                ECS_ZONE("build indices");
+                queries->index<Player>();
+                queries->index<Asteroid>();
+            }
 
-            for(auto e : entities)
+            manager->view<AI, Inputs, const Transform, const Velocity>().parallel_each([&](Entity, AI &ai, Inputs &inputs, auto &&transform, auto &&velocity)
             {
-                auto transform1 = transform_store.get_component(e);
-                auto inputs = inputs_store.get_component(e);
-                auto ai = ai_store.get_component(e);
-                auto velocity = velocity_store.get_component(e);
+                const Transform transform1 = transform;
 
                 // Reset inputs
-                inputs->up = false;
-                inputs->down = false;
-                inputs->left = false;
-                inputs->right = false;
-                inputs->selected = 0;
-                inputs->use = false;
-
-                float closest_dist = 1000000;
+                inputs.up = false;
+                inputs.down = false;
+                inputs.left = false;
+                inputs.right = false;
+                inputs.selected = 0;
+                inputs.use = false;
+
+                float closest_dist2 = 1000000.0f * 1000000.0f;
                 float closest_x = 0.0;
                 float closest_y = 0.0;
 
-                Entity closest_player = invalid_entity;
                 Entity closest_asteroid = invalid_entity;
 
-                ai->timer += dt;
+                ai.timer += dt;
 
-                if(ai->aggressive == true)
+                // Positions are the nearest copy of the target round the wrap
+                if(ai.aggressive == true)
                 {
-                    for(auto p : players)
+                    const Neighbour player = queries->nearest<Player>(transform1.x, transform1.y);
+                    if(player.entity != invalid_entity && player.dist2 < closest_dist2)
                     {
-                        auto transform2 = transform_store.get_component(p);
-
-                        float dx = transform2->x - transform1->x;
-                        //if(fabs(dx) > 200.0) {continue;}
-                        float dy = transform2->y - transform1->y;
-                        //if(fabs(dy) > 200.0) {continue;}
-
-                        float dist = sqrt(dx*dx + dy*dy);
-                        if(dist < closest_dist)
-                        {
-                            closest_dist = dist;
-                            closest_x = transform2->x;
-                            closest_y = transform2->y;
-                            closest_player = p;
-                        }
+                        closest_dist2 = player.dist2;
+                        closest_x = transform1.x + player.dx;
+                        closest_y = transform1.y + player.dy;
                     }
                 }
 
-                for(auto a : asteroids)
+                const Neighbour asteroid = queries->nearest<Asteroid>(transform1.x, transform1.y);
+                if(asteroid.entity != invalid_entity && asteroid.dist2 < closest_dist2)
                 {
-                    auto transform2 = transform_store.get_component(a);
-
-                    float dx = transform2->x - transform1->x;
-                    //if(fabs(dx) > 200.0) {continue;}
-                    float dy = transform2->y - transform1->y;
-                    //if(fabs(dy) > 200.0) {continue;}
-
-                    float dist = sqrt(dx*dx + dy*dy);
-                    if(dist < closest_dist)
-                    {
-                        closest_dist = dist;
-                        closest_x = transform2->x;
-                        closest_y = transform2->y;
-                        closest_asteroid = a;
-                    }
+                    closest_dist2 = asteroid.dist2;
+                    closest_x = transform1.x + asteroid.dx;
+                    closest_y = transform1.y + asteroid.dy;
+                    closest_asteroid = asteroid.entity;
                 }
+                const float closest_dist = std::sqrt(closest_dist2);
 
                 float barrel = 25.0;
                 if(closest_asteroid != invalid_entity && closest_dist >= barrel)
                 {
                     // Predict where we're aiming
-                    auto asteroid_transform = transform_store.get_component(closest_asteroid);
-                    auto asteroid_velocity = velocity_store.get_component(closest_asteroid);
+                    auto asteroid_velocity = velocity_store.read_component(closest_asteroid);
 
-                    float ship_x = transform1->x;
-                    float ship_y = transform1->y;
+                    float ship_x = transform1.x;
+                    float ship_y = transform1.y;
 
-                    float asteroid_x = asteroid_transform->x;
-                    float asteroid_y = asteroid_transform->y;
+                    float asteroid_x = closest_x;
+                    float asteroid_y = closest_y;
 
                     float asteroid_vx = asteroid_velocity->x;
                     float asteroid_vy = asteroid_velocity->y;
@@ -729,176 +803,158 @@ class AISystem : public System
                         float aim_y = asteroid_y + t * asteroid_vy;
                         float aim_dist = sqrt((aim_x-ship_x)*(aim_x-ship_x) + (aim_y-ship_y)*(aim_y-ship_y));
 
-                        inputs->mouse_x = aim_x;
-                        inputs->mouse_y = aim_y;
+                        inputs.mouse_x = aim_x;
+                        inputs.mouse_y = aim_y;
 
                         if(aim_dist <= 200.0)
                         {
-                            inputs->selected = 0;
-                            inputs->use = true;
+                            inputs.selected = 0;
+                            inputs.use = true;
                         }
 
-                        Entity new_entity = manager->em.get_entity();
-                        if(new_entity != invalid_entity)
-                        {
-                            manager->add_entity_component<Transform>(new_entity, Transform(aim_x, aim_y, 0.0));
-                            manager->add_entity_component<Size>(new_entity, Size(3.0));
-                            manager->add_entity_component<Render>(new_entity, Render(220, 20, 20));
-                            manager->remove.push_back(new_entity);
-                        }
+                        // Aim marker, the timer removes it after the frame it's drawn in
+                        manager->commands.create(Transform(aim_x, aim_y, 0.0), Size(3.0), Render(220, 20, 20), Timer(0.0));
                     }
                 }
 
-                float dx = closest_x - transform1->x;
-                float dy = closest_y - transform1->y;
+                float dx = closest_x - transform1.x;
+                float dy = closest_y - transform1.y;
 
-                dx = (dx > 512/2 ? 512-dx : dx);
-                dy = (dy > 512/2 ? 512-dy : dy);
+                dx = (dx > world/2 ? world-dx : dx);
+                dy = (dy > world/2 ? world-dy : dy);
 
                 if(dx > 100)
                 {
-                    if(velocity->x < 100.0)
+                    if(velocity.x < 100.0)
                     {
-                        inputs->right = true;
+                        inputs.right = true;
                     }
                     else
                     {
-                        inputs->left = true;
+                        inputs.left = true;
                     }
                 }
                 else if(dx < -100)
                 {
-                    if(velocity->x > -100.0)
+                    if(velocity.x > -100.0)
                     {
-                        inputs->left = true;
+                        inputs.left = true;
                     }
                     else
                     {
-                        inputs->right = true;
+                        inputs.right = true;
                     }
                 }
                 else if(dx > 0)
                 {
-                    inputs->left = true;
+                    inputs.left = true;
                 }
                 else if(dx < 0)
                 {
-                    inputs->right = true;
+                    inputs.right = true;
                 }
 
                 if(dy > 100)
                 {
-                    if(velocity->y < 100.0)
+                    if(velocity.y < 100.0)
                     {
-                        inputs->up = true;
+                        inputs.up = true;
                     }
                     else
                     {
-                        inputs->down = true;
+                        inputs.down = true;
                     }
                 }
                 else if(dy < -100)
                 {
-                    if(velocity->y > -100.0)
+                    if(velocity.y > -100.0)
                     {
-                        inputs->down = true;
+                        inputs.down = true;
                     }
                     else
                     {
-                        inputs->up = true;
+                        inputs.up = true;
                     }
                 }
                 else if(dy > 0)
                 {
-                    inputs->down = true;
+                    inputs.down = true;
                 }
                 else if(dy < 0)
                 {
-                    inputs->up = true;
+                    inputs.up = true;
                 }
-            }
+            });
         }
     private:
+        SpatialQueries *queries;
+        float world;
 };
 
 class MineAISystem : public System
 {
     public:
-        MineAISystem()
+        explicit MineAISystem(SpatialQueries *q) : queries(q)
+        {
+            required.set(MineAI::id);
+            required.set(Inputs::id);
+            required.set(Transform::id);
+            access.read<MineAI, Transform, Ship>();
+            access.write<Inputs>();
+            access.write_resource(SpatialResource);
+        }
+        void reserve(const std::size_t n)
         {
-            required.insert(MineAI::id);
+            queries->reserve<Ship>(n);
         }
         void update(const float dt)
         {
             assert(manager != nullptr);
 
-            auto &mine_ai_store = manager->cm.get_store<MineAI>();
-            auto &inputs_store = manager->cm.get_store<Inputs>();
-            auto &transform_store = manager->cm.get_store<Transform>();
-
-            auto ships = manager->cm.components[Ship::id];
-            for(auto e : entities)
+            manager->view<const MineAI, Inputs, const Transform>().each([this](Entity, const MineAI &mine_ai, Inputs &inputs, auto &&transform1)
             {
-                auto mine_ai = mine_ai_store.get_component(e);
-                auto inputs = inputs_store.get_component(e);
-
                 // Reset inputs
-                inputs->up = false;
-                inputs->down = false;
-                inputs->left = false;
-                inputs->right = false;
-                inputs->selected = 0;
-                inputs->use = false;
-
-                if(mine_ai->aggressive == false)
+                inputs.up = false;
+                inputs.down = false;
+                inputs.left = false;
+                inputs.right = false;
+                inputs.selected = 0;
+                inputs.use = false;
+
+                if(mine_ai.aggressive == false)
                 {
-                    continue;
+                    return;
                 }
 
-                float closest_dx = 0.0;
-                float closest_dy = 0.0;
-                float closest_dist = 1000000;
-
-                auto transform1 = transform_store.get_component(e);
-                for(auto s : ships)
-                {
-                    auto transform2 = transform_store.get_component(s);
-
-                    float dx = transform2->x - transform1->x;
-                    float dy = transform2->y - transform1->y;
-
-                    float dist = sqrt(dx*dx + dy*dy);
-                    if(dist < closest_dist)
-                    {
-                        closest_dx = dx;
-                        closest_dy = dy;
-                        closest_dist = dist;
-                    }
-                }
+                const Neighbour ship = queries->nearest<Ship>(transform1.x, transform1.y);
+                const float closest_dx = ship.dx;
+                const float closest_dy = ship.dy;
+                const float closest_dist = std::sqrt(ship.dist2);
 
                 if(closest_dist <= 200.0)
                 {
                     if(closest_dx > 0.0)
                     {
-                        inputs->right = true;
+                        inputs.right = true;
                     }
                     else
                     {
-                        inputs->left = true;
+                        inputs.left = true;
                     }
 
                     if(closest_dy < 0.0)
                     {
-                        inputs->down = true;
+                        inputs.down = true;
                     }
                     else
                     {
-                        inputs->up = true;
+                        inputs.up = true;
                     }
                 }
-            }
+            });
         }
     private:
+        SpatialQueries *queries;
 };
 
 #endif